@@ -0,0 +1,77 @@
+// ---------------------------------------------------
+// Created by Boguslaw Cyganek (C) 2024
+// ---------------------------------------------------
+
+
+
+// The benchmarks of the pipes - a separate project, always built in Release:
+//
+//		cmake -S bench -B build_bench && cmake --build build_bench --config Release
+//		CustomPipesBench [out_file.jsonl] [items]
+//
+// Each case is printed as one line of JSON, so the files of two versions can be compared line by line.
+
+
+
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <print>
+
+
+import pipe_bench;
+
+
+
+std::vector< TBenchResult > Payload_PipeBench( std::size_t items, const std::vector< std::size_t > & payload_sizes );
+
+std::vector< TBenchResult > NB_ParallelPipeBench( std::size_t items, const std::vector< std::size_t > & stages, const std::vector< std::size_t > & payload_sizes );
+
+bool Similarity_Check( const std::vector< std::size_t > & rows, const std::vector< std::size_t > & dims );
+
+std::vector< TBenchResult > Similarity_Bench( std::size_t repeats, const std::vector< std::size_t > & rows, const std::vector< std::size_t > & dims );
+
+
+
+
+
+auto main( int argc, char ** argv ) -> int
+{
+	const std::size_t		kItems { argc > 2 ? std::strtoull( argv[ 2 ], nullptr, 10 ) : 20000 };
+
+	const std::vector< std::size_t >	kPayloadSizes { 16, 256, 4096 };
+	const std::vector< std::size_t >	kStages { 1, 2, 4, 8, 16, 32, 64 };
+
+	std::ofstream		theFile;
+	if( argc > 1 )
+		theFile.open( argv[ 1 ] );
+
+	auto report = [ & ]( const std::vector< TBenchResult > & results )
+	{
+		for( const auto & r : results )
+		{
+			std::println( "{}", to_json( r ) );
+			if( theFile.is_open() )
+				theFile << to_json( r ) << "\n";
+		}
+	};
+
+	report( Payload_PipeBench( 10 * kItems, kPayloadSizes ) );		// the serial pipes are much faster
+
+	report( NB_ParallelPipeBench( kItems, kStages, kPayloadSizes ) );
+
+	// The SIMD kernels must give the same bits as the simple loop - otherwise their times mean nothing
+	// (300 is not a multiple of the SIMD width, and 3000 rows are more than one block of the columns)
+	if( not Similarity_Check( { 100, 3000 }, { 24, 300 } ) )
+		return 1;
+
+	report( Similarity_Bench( 3, { 1000, 3000, 10000 }, { 24, 256 } ) );
+
+	return theFile.is_open() && not theFile ? 1 : 0;
+}
+
+
+
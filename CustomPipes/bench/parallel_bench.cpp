@@ -0,0 +1,101 @@
+// ---------------------------------------------------
+// Created by Boguslaw Cyganek (C) 2024
+// ---------------------------------------------------
+
+
+
+// The benchmarks of the parallel pipe (see bench_main.cpp) - the stages are the same add_2 / add_3 as in the demos
+
+
+
+#include <cstddef>
+#include <cassert>
+#include <string>
+#include <vector>
+#include <memory>
+#include <memory_resource>
+
+
+import payload;
+import synchro_queue;
+import batch_stage;
+import parallel_pipe;
+import payload_stages;
+import pipe_bench;
+
+
+
+// The main thread pushes items objects through stages of add_2 / add_3 (or of their batch versions), and the sink takes their arrival times.
+// Each stage is one thread and the queues are FIFO, so the k-th object out is the k-th one in - this gives the latency of each object.
+template < NB_PayloadOrError_Queue_Type Queue >
+TBenchResult NB_ParallelPipeBench_Case(	std::shared_ptr< Queue > theFirstQueue, std::pmr::memory_resource * payload_mem, 
+														std::string variant, std::size_t stages, std::size_t bytes, std::size_t items, bool batched = false )
+{
+	assert( stages > 0 );
+
+	std::vector< BenchClock::time_point >	thePushTimes( items ), theArrivalTimes( items );
+	std::size_t		arrived {}, checksum {};
+
+	// Each stage in its own thread - otherwise add_2 | add_3 | ... (and the batch stages) would be fused into one
+	auto thePipe = batched ? theFirstQueue | batch( add_2_batch ) | split() : theFirstQueue | add_2 | split();
+	for( std::size_t i { 1 }; i < stages; ++ i )
+		thePipe = batched	? std::move( thePipe ) | batch( i % 2 ? add_3_batch : add_2_batch ) | split()
+								: std::move( thePipe ) | ( i % 2 ? add_3 : add_2 ) | split();
+
+	auto theRunningPipe = std::move( thePipe ) | sink( [ & ]( PayloadOrError && e )
+	{
+		theArrivalTimes[ arrived ++ ] = BenchClock::now();
+		checksum += e ? e->fStr.size() + e->fVal : 1;
+	} );
+
+	const std::string		theStr( bytes, 'x' );
+
+	for( std::size_t i {}; i < items; ++ i )
+	{
+		thePushTimes[ i ] = BenchClock::now();
+		theFirstQueue->push( MakePayload( theStr, static_cast< int >( i ), payload_mem ) );
+	}
+	theFirstQueue->close();
+
+	theRunningPipe.wait();		// also makes the writes of the sink visible here
+	assert( arrived == items );
+
+	std::vector< BenchClock::duration >	theLatencies( items );
+	for( std::size_t i {}; i < items; ++ i )
+		theLatencies[ i ] = theArrivalTimes[ i ] - thePushTimes[ i ];
+
+	return MakeBenchResult( "parallel_pipe", std::move( variant ), stages, bytes, 
+									items > 0 ? theArrivalTimes.back() - thePushTimes.front() : BenchClock::duration {}, theLatencies, checksum );
+}
+
+
+// All combinations of the numbers of stages (1..64) and the sizes of the payload string, with the locked and with the SPSC queues,
+// and with the strings in the default memory and in the pool - and with the batch stages
+std::vector< TBenchResult > NB_ParallelPipeBench( std::size_t items, const std::vector< std::size_t > & stages, const std::vector< std::size_t > & payload_sizes )
+{
+	constexpr std::size_t	kQueueCapacity { 256 };		// bounded - the latency is measured in the steady state, not in a growing queue
+
+	PayloadMemory		thePayloadMemory;		// the strings go back here when the sink is done with them, and are reused by the next ones
+
+	std::vector< TBenchResult >	out;
+
+	for( const auto n : stages )
+		for( const auto bytes : payload_sizes )
+		{
+			for( const bool pool : { false, true } )
+			{
+				auto * mem = pool ? & thePayloadMemory : std::pmr::get_default_resource();
+				const std::string	suffix { pool ? "+pool" : "" };
+
+				out.push_back( NB_ParallelPipeBench_Case( std::make_shared< NB_PayloadOrError_Queue >( kQueueCapacity ), mem, "synchro_queue" + suffix, n, bytes, items ) );
+				out.push_back( NB_ParallelPipeBench_Case( std::make_shared< NB_PayloadOrError_SpscQueue >(), mem, "spsc_queue" + suffix, n, bytes, items ) );
+			}
+
+			out.push_back( NB_ParallelPipeBench_Case( std::make_shared< NB_PayloadOrError_Queue >( kQueueCapacity ), std::pmr::get_default_resource(), "synchro_queue+batch", n, bytes, items, true ) );
+		}
+
+	return out;
+}
+
+
+
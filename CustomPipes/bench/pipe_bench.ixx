@@ -0,0 +1,85 @@
+// ---------------------------------------------------
+// Created by Boguslaw Cyganek (C) 2024
+// ---------------------------------------------------
+
+
+export module pipe_bench;
+
+
+
+
+import <cstddef>;
+import <string>;
+import <vector>;
+import <algorithm>;
+import <chrono>;
+import <format>;
+
+
+
+// -----------------------------------------------------------
+// The common part of the benchmarks of the pipes (see the bench project).
+// Each case is measured as the total time of all objects (throughput)
+// and the time of each object (latency), and reported as one line of JSON.
+
+
+
+export using BenchClock = std::chrono::steady_clock;
+
+
+
+export struct TBenchResult
+{
+	std::string			fCase;				// e.g. "serial_pipe", "parallel_pipe"
+	std::string			fVariant;			// e.g. the type of the queues
+
+	std::size_t			fStages {};
+	std::size_t			fPayloadBytes {};
+	std::size_t			fItems {};
+
+	double				fSeconds {};
+	double				fItemsPerSec {};
+
+	double				fLatencyP50Us {};
+	double				fLatencyP99Us {};
+
+	std::size_t			fChecksum {};		// computed from the results - so they are not optimized away, and can be compared
+};
+
+
+
+// Fills in the times - latencies are the times of all objects (they are sorted here)
+export inline TBenchResult MakeBenchResult(	std::string case_name, std::string variant, std::size_t stages, std::size_t payload_bytes,
+													BenchClock::duration total, std::vector< BenchClock::duration > & latencies, std::size_t checksum )
+{
+	using USec = std::chrono::duration< double, std::micro >;
+
+	TBenchResult	r { std::move( case_name ), std::move( variant ), stages, payload_bytes, latencies.size() };
+
+	r.fSeconds		= std::chrono::duration< double >( total ).count();
+	r.fItemsPerSec	= r.fSeconds > 0.0 ? r.fItems / r.fSeconds : 0.0;
+
+	if( not latencies.empty() )
+	{
+		std::ranges::sort( latencies );
+		r.fLatencyP50Us	= USec( latencies[ latencies.size() / 2 ] ).count();
+		r.fLatencyP99Us	= USec( latencies[ std::min( latencies.size() - 1, latencies.size() * 99 / 100 ) ] ).count();
+	}
+
+	r.fChecksum = checksum;
+	return r;
+}
+
+
+
+// One line of JSON (with no new line at the end)
+export inline std::string to_json( const TBenchResult & r )
+{
+	return std::format(	"{{ \"case\": \"{}\", \"variant\": \"{}\", \"stages\": {}, \"payload_bytes\": {}, \"items\": {}, "
+								"\"seconds\": {:.6f}, \"items_per_s\": {:.1f}, \"p50_us\": {:.3f}, \"p99_us\": {:.3f}, \"checksum\": {} }}",
+								r.fCase, r.fVariant, r.fStages, r.fPayloadBytes, r.fItems,
+								r.fSeconds, r.fItemsPerSec, r.fLatencyP50Us, r.fLatencyP99Us, r.fChecksum );
+}
+
+
+
@@ -0,0 +1,138 @@
+// ---------------------------------------------------
+// Created by Boguslaw Cyganek (C) 2024
+// ---------------------------------------------------
+
+
+
+// The benchmarks of the serial pipes (see bench_main.cpp) - the operators | and compose() come from the serial_pipe module
+
+
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <expected>
+#include <utility>
+#include <memory_resource>
+
+
+import payload;
+import pipe_stage;
+import serial_pipe;
+import pipe_bench;
+
+
+
+
+// The same as Payload_Proc_1..3, but with no printing and with deterministic errors,
+// so only the cost of the pipe is measured
+PayloadOrError Bench_Proc_1( PayloadOrError && s )
+{
+	if( ! s )
+		return s;
+	++ s->fVal;
+	s->fStr += '1';
+	return s;
+}
+
+PayloadOrError Bench_Proc_2( PayloadOrError && s )
+{
+	if( ! s )
+		return s;
+	++ s->fVal;
+	s->fStr += '2';
+	if( s->fVal % 1024 == 0 )
+		return std::unexpected { OpErrorType::kOverflow };		// one error per 1024 objects
+	return s;
+}
+
+PayloadOrError Bench_Proc_3( PayloadOrError && s )
+{
+	if( ! s )
+		return s;
+	++ s->fVal;
+	s->fStr += '3';
+	return s;
+}
+
+// The same for the short-circuit mode
+PayloadOrError Bench_Step_1( Payload && s )
+{
+	++ s.fVal;
+	s.fStr += '1';
+	return std::move( s );
+}
+
+PayloadOrError Bench_Step_2( Payload && s )
+{
+	++ s.fVal;
+	s.fStr += '2';
+	if( s.fVal % 1024 == 0 )
+		return std::unexpected { OpErrorType::kOverflow };
+	return std::move( s );
+}
+
+PayloadOrError Bench_Step_3( Payload && s )
+{
+	++ s.fVal;
+	s.fStr += '3';
+	return std::move( s );
+}
+
+
+// Runs the three stages with operator | (in both modes), with .and_then and as the composed pipe,
+// for each size of the payload string, with the strings in the default memory and in the pool
+std::vector< TBenchResult > Payload_PipeBench( std::size_t items, const std::vector< std::size_t > & payload_sizes )
+{
+	enum class EPipe { kCallAll, kAndThen, kShortCircuit, kComposed };
+
+	const auto theComposed = compose( fn< Bench_Proc_1 >, fn< Bench_Proc_2 >, fn< Bench_Proc_3 > );		// built once
+
+	std::vector< TBenchResult >	out;
+
+	for( const auto bytes : payload_sizes )
+	{
+		const std::string		theStr( bytes, 'x' );
+
+		std::pmr::unsynchronized_pool_resource	thePayloadMemory;		// one thread - no need to synchronize
+
+		for( const bool pool : { false, true } )
+		{
+			auto * mem = pool ? & thePayloadMemory : std::pmr::get_default_resource();
+
+			for( const auto pipe : { EPipe::kCallAll, EPipe::kAndThen, EPipe::kShortCircuit, EPipe::kComposed } )
+			{
+				std::vector< BenchClock::duration >	theLatencies;
+				theLatencies.reserve( items );
+				std::size_t		checksum {};
+
+				const auto t_start = BenchClock::now();
+				for( std::size_t i {}; i < items; ++ i )
+				{
+					const auto t_item = BenchClock::now();
+
+					PayloadOrError	in { MakePayload( theStr, static_cast< int >( i ), mem ) };
+
+					auto res =	pipe == EPipe::kAndThen	? std::move( in ).and_then( Bench_Proc_1 ).and_then( Bench_Proc_2 ).and_then( Bench_Proc_3 )
+								:	pipe == EPipe::kCallAll	? std::move( in ) | Bench_Proc_1 | Bench_Proc_2 | Bench_Proc_3
+								:	pipe == EPipe::kComposed	? theComposed( std::move( in ) )
+																	: std::move( in ) | Bench_Step_1 | Bench_Step_2 | Bench_Step_3;
+
+					theLatencies.push_back( BenchClock::now() - t_item );
+					checksum += res ? res->fStr.size() + res->fVal : 1;
+				}
+
+				constexpr const char *	kNames[] { "serial_pipe", "serial_and_then", "serial_short_circuit", "serial_composed" };
+
+				out.push_back( MakeBenchResult( kNames[ static_cast< int >( pipe ) ], pool ? "expected+pool" : "expected", 3, bytes,
+																BenchClock::now() - t_start, theLatencies, checksum ) );
+			}
+		}
+	}
+
+	return out;
+}
+
+
+
+
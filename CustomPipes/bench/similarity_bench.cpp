@@ -0,0 +1,236 @@
+// ---------------------------------------------------
+// Created by Boguslaw Cyganek (C) 2024
+// ---------------------------------------------------
+
+
+
+// The benchmarks of the similarity module (see bench_main.cpp) - gram_upper, max_pair and nearest at each SIMD level
+// of this CPU. First, Similarity_Check compares the results of each level with the simple loop of std::inner_product -
+// they must be the same to the last bit (see the similarity module).
+
+
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <random>
+#include <bit>
+#include <cstdint>
+#include <format>
+#include <print>
+
+
+import dense_matrix;
+import thread_pool;
+import similarity;
+import pipe_bench;
+
+
+
+namespace
+{
+
+	constexpr ESimdLevel	kAllLevels[] { ESimdLevel::kScalar, ESimdLevel::kAVX2, ESimdLevel::kAVX512 };
+
+	const char * LevelName( ESimdLevel level )
+	{
+		return level == ESimdLevel::kAVX512 ? "avx512" : level == ESimdLevel::kAVX2 ? "avx2" : "scalar";
+	}
+
+	// The normalized random vectors, always the same
+	TDenseMatrix< double > RandomRows( std::size_t n, std::size_t d )
+	{
+		std::mt19937_64								theGen( n * 1000 + d );
+		std::normal_distribution< double >	theDistr;
+
+		TDenseMatrix< double >	x( n, d );
+		for( std::size_t r {}; r < n; ++ r )
+		{
+			std::ranges::generate( x.row( r ), [ & ]() { return theDistr( theGen ); } );
+			normalize_row( x.row( r ) );
+		}
+		return x;
+	}
+
+	// The simple loop - what each SIMD level must give exactly
+	TDenseMatrix< double > RefGram( const TDenseMatrix< double > & x )
+	{
+		TDenseMatrix< double >	out( x.rows(), x.rows() );
+		for( std::size_t r {}; r < x.rows(); ++ r )
+			for( std::size_t c { r + 1 }; c < x.rows(); ++ c )
+				out( r, c ) = std::inner_product( x.row( r ).begin(), x.row( r ).end(), x.row( c ).begin(), 0.0 );
+		return out;
+	}
+
+	bool Same( double a, double b ) { return std::bit_cast< std::uint64_t >( a ) == std::bit_cast< std::uint64_t >( b ); }
+
+	bool Same( const TPairSim & a, const TPairSim & b ) { return a.fRow == b.fRow && a.fCol == b.fCol && Same( a.fVal, b.fVal ); }
+
+	// The first difference of the upper triangles, or the empty string
+	std::string CompareUpper( const TDenseMatrix< double > & ref, const TDenseMatrix< double > & m )
+	{
+		for( std::size_t r {}; r < ref.rows(); ++ r )
+			for( std::size_t c { r + 1 }; c < ref.rows(); ++ c )
+				if( not Same( ref( r, c ), m( r, c ) ) )
+					return std::format( "( {}, {} ): {:a} != {:a}", r, c, m( r, c ), ref( r, c ) );
+		return {};
+	}
+
+	// The k_pairs best pairs and the k_nn nearest neighbours of each row, straight from the whole matrix
+	TNearest RefNearest( const TDenseMatrix< double > & ref, std::size_t k_pairs, std::size_t k_nn )
+	{
+		const std::size_t	n { ref.rows() };
+
+		TNearest	theResult;
+		theResult.fK = std::min( k_nn, n - 1 );
+
+		for( std::size_t r {}; r < n; ++ r )
+			for( std::size_t c { r + 1 }; c < n; ++ c )
+				theResult.fTopPairs.push_back( { r, c, ref( r, c ) } );
+		std::ranges::sort( theResult.fTopPairs, is_better );
+		theResult.fTopPairs.resize( std::min( k_pairs, theResult.fTopPairs.size() ) );
+
+		std::vector< TNeighbour >	theRow;
+		for( std::size_t r {}; r < n; ++ r )
+		{
+			theRow.clear();
+			for( std::size_t c {}; c < n; ++ c )
+				if( c != r )
+					theRow.push_back( { c, c > r ? ref( r, c ) : ref( c, r ) } );
+			std::ranges::sort( theRow, is_nearer );
+			theResult.fNeighbours.insert( theResult.fNeighbours.end(), theRow.begin(), theRow.begin() + theResult.fK );
+		}
+		return theResult;
+	}
+
+	std::string CompareNearest( const TNearest & ref, const TNearest & res )
+	{
+		if( ref.fTopPairs.size() != res.fTopPairs.size() || ref.fNeighbours.size() != res.fNeighbours.size() )
+			return "different sizes";
+		for( std::size_t i {}; i < ref.fTopPairs.size(); ++ i )
+			if( not Same( ref.fTopPairs[ i ], res.fTopPairs[ i ] ) )
+				return std::format( "top pair #{}", i );
+		for( std::size_t i {}; i < ref.fNeighbours.size(); ++ i )
+			if( ref.fNeighbours[ i ].fIdx != res.fNeighbours[ i ].fIdx || not Same( ref.fNeighbours[ i ].fVal, res.fNeighbours[ i ].fVal ) )
+				return std::format( "neighbour #{} of row {}", i % ref.fK, i / ref.fK );
+		return {};
+	}
+
+}
+
+
+
+// Checks all levels up to SimdLevel() - the errors are printed to stderr. Returns false if any result differs.
+bool Similarity_Check( const std::vector< std::size_t > & rows, const std::vector< std::size_t > & dims )
+{
+	constexpr std::size_t	kPairs { 10 }, kNN { 8 };
+
+	TWorkStealingPool	thePool( 64 );		// the work is cut as on a big machine, whatever the number of cores here
+	bool		allSame { true };
+
+	auto report = [ & ]( std::string_view what, ESimdLevel level, std::size_t n, std::size_t d, const std::string & diff )
+	{
+		if( diff.empty() )
+			return;
+		std::println( stderr, "similarity check failed: {} at {} for n={} d={} - {}", what, LevelName( level ), n, d, diff );
+		allSame = false;
+	};
+
+	for( const auto n : rows )
+		for( const auto d : dims )
+		{
+			const auto	x { RandomRows( n, d ) };
+			const auto	theRef { RefGram( x ) };
+			const auto	theRefNearest { RefNearest( theRef, kPairs, kNN ) };
+
+			for( const auto level : kAllLevels )
+			{
+				if( level > SimdLevel() )
+					break;
+
+				TDenseMatrix< double >	theSims( n, n );
+				gram_upper( x, theSims, level );
+				report( "gram_upper", level, n, d, CompareUpper( theRef, theSims ) );
+
+				TDenseMatrix< double >	theParSims( n, n );
+				gram_upper( x, theParSims, thePool, level );
+				report( "gram_upper( pool )", level, n, d, CompareUpper( theRef, theParSims ) );
+
+				if( const auto res = max_pair( x, thePool, level ); not Same( res, theRefNearest.fTopPairs.front() ) )
+					report( "max_pair", level, n, d, std::format( "( {}, {}, {:a} )", res.fRow, res.fCol, res.fVal ) );
+
+				report( "nearest", level, n, d, CompareNearest( theRefNearest, nearest( x, kPairs, kNN, thePool, level ) ) );
+			}
+		}
+
+	return allSame;
+}
+
+
+
+// Each case is run repeats times at each level - the latencies are of the runs.
+// The variant tells the level and the number of the vectors, the payload is the size of one vector.
+std::vector< TBenchResult > Similarity_Bench( std::size_t repeats, const std::vector< std::size_t > & rows, const std::vector< std::size_t > & dims )
+{
+	constexpr std::size_t	kPairs { 10 }, kNN { 8 };
+	constexpr std::size_t	kMaxGramRows { 4096 };		// the N x N result must fit in the memory
+
+	auto &	thePool { SimilarityPool() };
+
+	std::vector< TBenchResult >	out;
+
+	for( const auto n : rows )
+		for( const auto d : dims )
+		{
+			const auto	x { RandomRows( n, d ) };
+
+			for( const auto level : kAllLevels )
+			{
+				if( level > SimdLevel() )
+					break;
+
+				const std::string		theVariant { std::format( "{}/n={}", LevelName( level ), n ) };
+
+				auto run = [ & ]( std::string case_name, auto && fun )
+				{
+					std::vector< BenchClock::duration >	theLatencies;
+					std::size_t		checksum {};
+
+					const auto t_start = BenchClock::now();
+					for( std::size_t i {}; i < repeats; ++ i )
+					{
+						const auto t_run = BenchClock::now();
+						checksum += fun();
+						theLatencies.push_back( BenchClock::now() - t_run );
+					}
+
+					out.push_back( MakeBenchResult( std::move( case_name ), theVariant, thePool.size(), d * sizeof( double ), BenchClock::now() - t_start, theLatencies, checksum ) );
+				};
+
+				if( n <= kMaxGramRows )
+				{
+					TDenseMatrix< double >	theSims( n, n );
+					run( "similarity_gram_upper", [ & ]() { gram_upper( x, theSims, thePool, level ); return std::size_t { theSims( 0, n - 1 ) > 0.0 }; } );
+				}
+
+				run( "similarity_max_pair", [ & ]() { const auto p = max_pair( x, thePool, level ); return p.fRow + p.fCol; } );
+
+				run( "similarity_nearest", [ & ]()
+				{
+					const auto	theNearest { nearest( x, kPairs, kNN, thePool, level ) };
+					std::size_t	sum {};
+					for( const auto & nb : theNearest.fNeighbours )
+						sum += nb.fIdx;
+					return sum;
+				} );
+			}
+		}
+
+	return out;
+}
+
+
+
@@ -38,6 +38,8 @@ namespace CppBook
 // The range utility. Allows combination of the indexed
 // and range based for loops.
 // Template type deduction is used.
+// All members are constexpr, so it can be used also in the constant
+// evaluation, e.g. to fill in a lookup table at compile time.
 // Examples:
 //
 //	for( auto i : range( 123 ) )
@@ -70,7 +72,7 @@ class range
 		// UWAGI:
 		//		Jeśli step = 0, zgłaszany jest wyjątek std::out_of_range
 		//
-		range( const T from, const T end, const T step = 1 ) 
+		constexpr range( const T from, const T end, const T step = 1 ) 
 			: kFrom( from ), kEnd( end ), kStep( step ) 
 		{
 			assert( kStep != 0 );
@@ -79,7 +81,7 @@ class range
 		}
 
 		// Domyślnie from==0, step==1
-		range( const T end ) 
+		constexpr range( const T end ) 
 			: kFrom( 0 ), kEnd( end ), kStep( 1 ) 
 		{
 			assert( kEnd > 0 );
@@ -93,11 +95,11 @@ class range
 			const T kStep {};
 		public:
 
-			range_iter( const T v, const T step ) : fVal( v ), kStep( step ) {}
-			operator T  () const						{ return fVal; }
-			operator const T & ()					{ return fVal; }
-			const T operator * () const			{ return fVal; }
-			const range_iter & operator ++ ()	{ fVal += kStep; return * this; }
+			constexpr range_iter( const T v, const T step ) : fVal( v ), kStep( step ) {}
+			constexpr operator T  () const						{ return fVal; }
+			constexpr operator const T & ()					{ return fVal; }
+			constexpr const T operator * () const			{ return fVal; }
+			constexpr const range_iter & operator ++ ()	{ fVal += kStep; return * this; }
 
 
 			// Common to all iterators - add these to allow std::copy etc.
@@ -109,12 +111,12 @@ class range
 			using iterator_concept		= std::forward_iterator_tag;
 
 
-			bool operator == ( const range_iter & ri ) const
+			constexpr bool operator == ( const range_iter & ri ) const
 			{
 				return ! operator != ( ri );
 			}
 
-			bool operator != ( const range_iter & ri ) const
+			constexpr bool operator != ( const range_iter & ri ) const
 			{	
 				// To jest podchwytliwa część – podczas pracy iterator
 				// sprawdza koniec wywołując !=, więc musi to być traf w celu zatrzymania;
@@ -126,13 +128,14 @@ class range
 
 	public:
 
-        const range_iter begin()	{ return range_iter( kFrom, kStep ); }
-        const range_iter end()		{ return range_iter( kEnd,	kStep ); }
+        constexpr const range_iter begin() const	{ return range_iter( kFrom, kStep ); }
+        constexpr const range_iter end() const		{ return range_iter( kEnd,	kStep ); }
 
     public:
 
 		// Konwersja do dowolnego vector< T >
-		operator std::vector< T > ( void ) 
+		// (in the constant evaluation the vector must be freed before its end)
+		constexpr operator std::vector< T > ( void ) const
 		{
 			auto p = [this]( auto v ){ for( T i {kFrom}; i<kEnd; i+=kStep ) v.push_back(i); return v; };
 			auto n = [this]( auto v ){ for( T i {kFrom}; i>kEnd; i+=kStep ) v.push_back(i); return v; };
@@ -0,0 +1,23 @@
+// ---------------------------------------------------
+// Created by Boguslaw Cyganek (C) 2024
+// ---------------------------------------------------
+
+
+#pragma once
+
+
+// The SIMD kernels are compiled always (on x86) and chosen at run time, by what the CPU can do (see SimdLevel()).
+// MSVC lets us use all intrinsics in any function, GCC and Clang need the target of each function.
+// Include it in the global module fragment (after module;) - the macros do not pass through import.
+#if defined( _M_X64 ) || defined( __x86_64__ )
+	#define SIMD_X86
+	#include <immintrin.h>
+	#if defined( _MSC_VER )
+		#include <intrin.h>		// __cpuid, _xgetbv
+		#define SIMD_TARGET_AVX2
+		#define SIMD_TARGET_AVX512
+	#else
+		#define SIMD_TARGET_AVX2		__attribute__(( target( "avx2" ) ))
+		#define SIMD_TARGET_AVX512	__attribute__(( target( "avx512f" ) ))
+	#endif
+#endif
@@ -25,6 +25,28 @@ namespace Monadic_VectorsPipeTest
 
 void NB_ParallelPipelineTest();
 
+void NB_SpscPipelineTest();
+
+void NB_BoundedPipelineTest();
+
+void NB_CancelPipelineTest();
+
+void NB_ReplicatedPipelineTest();
+
+void NB_InstrumentedPipelineTest();
+
+void NB_PooledPipelineTest();
+
+void NB_AsyncPipelinesTest();
+
+void NB_TypedPipelineTest();
+
+void NB_FusedPipelineTest();
+
+void NB_SmallPayloadPipelineTest();
+
+void NB_BatchPipelineTest();
+
 
 
 
@@ -40,6 +62,39 @@ auto main() -> int
 	std::println( "\n=================\nRun parallel pipe - NB_ParallelPipelineTest ... " );
 	NB_ParallelPipelineTest();
 
+	std::println( "\n=================\nRun parallel pipe with SPSC queues - NB_SpscPipelineTest ... " );
+	NB_SpscPipelineTest();
+
+	std::println( "\n=================\nRun parallel pipe with bounded queues - NB_BoundedPipelineTest ... " );
+	NB_BoundedPipelineTest();
+
+	std::println( "\n=================\nRun parallel pipe stopped in the middle - NB_CancelPipelineTest ... " );
+	NB_CancelPipelineTest();
+
+	std::println( "\n=================\nRun parallel pipe with a replicated stage - NB_ReplicatedPipelineTest ... " );
+	NB_ReplicatedPipelineTest();
+
+	std::println( "\n=================\nRun instrumented parallel pipe - NB_InstrumentedPipelineTest ... " );
+	NB_InstrumentedPipelineTest();
+
+	std::println( "\n=================\nRun parallel pipe in the thread pool - NB_PooledPipelineTest ... " );
+	NB_PooledPipelineTest();
+
+	std::println( "\n=================\nRun many coroutine pipes - NB_AsyncPipelinesTest ... " );
+	NB_AsyncPipelinesTest();
+
+	std::println( "\n=================\nRun typed parallel pipe - NB_TypedPipelineTest ... " );
+	NB_TypedPipelineTest();
+
+	std::println( "\n=================\nRun parallel pipe with fused stages - NB_FusedPipelineTest ... " );
+	NB_FusedPipelineTest();
+
+	std::println( "\n=================\nRun typed parallel pipe of the small payloads - NB_SmallPayloadPipelineTest ... " );
+	NB_SmallPayloadPipelineTest();
+
+	std::println( "\n=================\nRun parallel pipe with batch stages - NB_BatchPipelineTest ... " );
+	NB_BatchPipelineTest();
+
 	return 0;
 }
 
@@ -0,0 +1,277 @@
+// ---------------------------------------------------
+// Created by Boguslaw Cyganek (C) 2024
+// ---------------------------------------------------
+
+
+export module async_queue;
+
+
+
+
+import <cstddef>;
+import <expected>;
+import <optional>;
+import <queue>;
+import <deque>;
+import <mutex>;
+import <condition_variable>;
+import <coroutine>;
+import <exception>;
+import <cassert>;
+
+import thread_pool;
+import synchro_queue;		// for EQueueErr
+
+
+
+// -----------------------------------------------------------
+// The C++20 coroutine support for the pipes.
+// A stage is a coroutine which co_awaits the next element from TAsyncQueue.
+// If there is nothing to take, then the coroutine is suspended and does not
+// hold any thread. It is resumed in the thread pool as soon as an element is pushed.
+// Thus thousands of pipes can be run by a few threads.
+
+
+
+// The return type of the stage coroutines. Such a coroutine starts at once,
+// and its frame is destroyed when it finishes - nobody waits for its result.
+export struct TAsyncTask
+{
+	struct promise_type
+	{
+		TAsyncTask get_return_object() noexcept { return {}; }
+
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+
+		void return_void() noexcept {}
+
+		void unhandled_exception() noexcept { std::terminate(); }
+	};
+};
+
+
+
+// co_await resume_on( pool ) moves the rest of the coroutine to a thread of the pool
+export auto resume_on( TWorkStealingPool & pool )
+{
+	struct ResumeOnAwaiter
+	{
+		TWorkStealingPool &		fPool;
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend( std::coroutine_handle<> h ) { fPool.submit( [ h ]() { h.resume(); } ); }
+		void await_resume() const noexcept {}
+	};
+
+	return ResumeOnAwaiter { pool };
+}
+
+
+
+// -----------------------------------------------------------
+// The unbounded queue with the awaitable pop - co_await q.pop_async().
+// The waiting coroutines are served first, in the FIFO order - a pushed element
+// goes directly to the first of them, which is then resumed in the thread pool.
+// There is also the blocking pop() for the consumers that are not coroutines.
+// close() and cancel() work as in TSynchroQueue - the suspended coroutines are resumed with the error.
+
+
+export template < typename Elem >
+class TAsyncQueue
+{
+
+public:
+
+	using value_type = Elem;
+
+	using ExpectedElem = std::expected< Elem, EQueueErr >;
+
+private:
+
+	class PopAwaiter
+	{
+	public:
+
+		explicit PopAwaiter( TAsyncQueue & q ) : fQueue( q ) {}
+
+		bool await_ready() { return fQueue.TryTake( fElem ); }
+
+		// Returns false if an element came in the meantime - then the coroutine goes on at once
+		bool await_suspend( std::coroutine_handle<> h )
+		{
+			fHandle = h;
+			return fQueue.TakeOrWait( * this );
+		}
+
+		ExpectedElem await_resume()
+		{
+			if( fElem )
+				return ExpectedElem( std::move( * fElem ) );
+			return std::unexpected( fQueue.StopReason() );		// no element means that the queue was closed or cancelled
+		}
+
+	private:
+
+		friend class TAsyncQueue;
+
+		TAsyncQueue &					fQueue;
+
+		std::optional< Elem >		fElem;
+
+		std::coroutine_handle<>		fHandle;
+	};
+
+public:
+
+	explicit TAsyncQueue( TWorkStealingPool & pool ) : fPool( pool ) {}
+
+	TAsyncQueue & operator = ( TAsyncQueue && ) = delete;
+
+public:
+
+	void push( Elem && in_elem )
+	{
+		std::coroutine_handle<>		waiter_handle;
+
+		{
+			std::unique_lock	theLock( fMutex );
+
+			if( fClosed )
+			{
+				assert( fCancelled );		// as in TSynchroQueue - pushing to the cancelled queue is ignored
+				return;
+			}
+
+			if( fWaiters.empty() )
+			{
+				fQueue.emplace( std::move( in_elem ) );
+			}
+			else
+			{
+				// Give the element directly to the first waiting coroutine
+				auto * waiter = fWaiters.front();
+				fWaiters.pop_front();
+				waiter->fElem.emplace( std::move( in_elem ) );
+				waiter_handle = waiter->fHandle;
+			}
+		}
+
+		if( waiter_handle )
+			fPool.submit( [ waiter_handle ]() { waiter_handle.resume(); } );
+		else
+			fCondVar.notify_one();
+	}
+
+	// To be called as co_await q.pop_async() - suspends the coroutine if the queue is empty
+	PopAwaiter pop_async( void ) { return PopAwaiter( * this ); }
+
+	// Blocks the calling thread until the queue is not empty
+	ExpectedElem pop( void )
+	{
+		std::unique_lock	theLock( fMutex );
+
+		fCondVar.wait( theLock, [ this ]() { return not fQueue.empty() || fClosed; } );
+
+		if( fQueue.empty() )
+			return std::unexpected( StopReason() );
+
+		ExpectedElem out_elem( std::move( fQueue.front() ) );
+		fQueue.pop();
+		return out_elem;
+	}
+
+	// The end of the data - the waiting coroutines are resumed and get EQueueErr::kClosed
+	void close() { Stop( false ); }
+
+	// Abort - the elements still in the queue are dropped
+	void cancel() { Stop( true ); }
+
+	bool is_cancelled() const
+	{
+		std::unique_lock	theLock( fMutex );
+		return fCancelled;
+	}
+
+	// This is not thread safe!
+	auto size() const { return fQueue.size(); }
+
+	auto & pool() const { return fPool; }
+
+private:
+
+	void Stop( bool cancel )
+	{
+		std::deque< PopAwaiter * >		waiters;
+
+		{
+			std::unique_lock	theLock( fMutex );
+			fClosed = true;
+			fCancelled = fCancelled || cancel;
+			if( fCancelled )
+				fQueue = {};
+			waiters.swap( fWaiters );		// the queue was empty for them, so it is empty now
+		}
+
+		for( auto * waiter : waiters )
+			fPool.submit( [ h = waiter->fHandle ]() { h.resume(); } );
+
+		fCondVar.notify_all();
+	}
+
+	EQueueErr StopReason() const
+	{
+		std::unique_lock	theLock( fMutex );
+		return fCancelled ? EQueueErr::kCancelled : EQueueErr::kClosed;
+	}
+
+	// Returns true if there is no need to wait - we have the element or the queue is closed
+	bool TryTake( std::optional< Elem > & out_elem )
+	{
+		std::unique_lock	theLock( fMutex );
+		return TakeFront( out_elem ) || fClosed;
+	}
+
+	bool TakeOrWait( PopAwaiter & awaiter )
+	{
+		std::unique_lock	theLock( fMutex );
+
+		if( TakeFront( awaiter.fElem ) || fClosed )
+			return false;		// do not suspend
+
+		fWaiters.push_back( & awaiter );
+		return true;
+	}
+
+	// Must be called under the lock
+	bool TakeFront( std::optional< Elem > & out_elem )
+	{
+		if( fQueue.empty() )
+			return false;
+
+		out_elem.emplace( std::move( fQueue.front() ) );
+		fQueue.pop();
+		return true;
+	}
+
+private:
+
+	TWorkStealingPool &				fPool;
+
+	std::queue< Elem >				fQueue;
+
+	std::deque< PopAwaiter * >		fWaiters;		// the suspended coroutines - they live in the coroutine frames
+
+	mutable std::mutex				fMutex;
+
+	std::condition_variable			fCondVar;		// for the blocking pop()
+
+	bool									fClosed {};
+
+	bool									fCancelled {};		// implies fClosed
+
+};
+
+
+
+
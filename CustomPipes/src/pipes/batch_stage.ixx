@@ -0,0 +1,201 @@
+// ---------------------------------------------------
+// Created by Boguslaw Cyganek (C) 2024
+// ---------------------------------------------------
+
+
+module;
+
+#include "simd_target.h"		// the AVX2 kernel is compiled always (on x86), and called only if the CPU has AVX2
+
+export module batch_stage;
+
+
+
+
+import <cstddef>;
+import <string_view>;
+import <tuple>;
+import <utility>;
+import <functional>;
+import <type_traits>;
+import <concepts>;
+
+import payload;
+import simd_level;
+
+
+
+// -----------------------------------------------------------
+// The batch stages.
+// A batch kernel takes the whole batch of PayloadOrError in the SoA form (see TPayloadBatch),
+// i.e. the columns of the values and the strings, and the mask of the errors. This way
+// the integer transforms are loops over the column of ints, which run at the speed of the memory.
+// The scalar stage functions (PayloadOrError -> PayloadOrError) are lifted automatically -
+// they are called for each object of the batch, so both kinds can be mixed in one stage.
+// Examples:
+//
+//		auto add_2_batch = []( TPayloadBatch & b ) { append_to_strs( b, "_2" ); add_to_vals( b, 2 ); };
+//
+//		auto out_q = ( in_q | batch( add_2_batch, add_3 ) | add_2 ).run();		// add_3 is lifted
+//
+
+
+
+export template < typename F >
+concept BatchKernel = std::invocable< F &, TPayloadBatch & >;
+
+export template < typename F >
+concept ScalarStage = std::invocable< F &, PayloadOrError && >
+							&& std::same_as< std::invoke_result_t< F &, PayloadOrError && >, PayloadOrError >;
+
+
+
+
+// The kernels - the lanes of the errors are left untouched
+
+#if defined( SIMD_X86 )
+// 8 lanes at once - the mask is made out of the 8 bytes of valid (0 or 1) widened to 0 or -1.
+// Returns the number of the values done, i.e. n rounded down to the multiple of 8.
+SIMD_TARGET_AVX2
+inline std::size_t AddToVals_AVX2( int * vals, const unsigned char * valid, std::size_t n, int v )
+{
+	const __m256i	v8 { _mm256_set1_epi32( v ) };
+
+	std::size_t	i {};
+	for( ; i + 8 <= n; i += 8 )
+	{
+		const __m256i	mask { _mm256_sub_epi32( _mm256_setzero_si256(), _mm256_cvtepu8_epi32( _mm_loadl_epi64( reinterpret_cast< const __m128i * >( valid + i ) ) ) ) };
+		auto *			p { reinterpret_cast< __m256i * >( vals + i ) };
+		_mm256_storeu_si256( p, _mm256_add_epi32( _mm256_loadu_si256( p ), _mm256_and_si256( v8, mask ) ) );
+	}
+	return i;
+}
+#endif
+
+// Adds v to all values of the batch
+export inline void add_to_vals( TPayloadBatch & b, int v )
+{
+	const std::size_t	n { b.size() };
+	int *						vals { b.fVals.data() };
+	const unsigned char *	valid { b.fValid.data() };
+
+	std::size_t	i {};
+
+#if defined( SIMD_X86 )
+	if( SimdLevel() != ESimdLevel::kScalar )		// AVX-512 comes with AVX2
+		i = AddToVals_AVX2( vals, valid, n, v );
+#endif
+
+	// The rest (or all, with no AVX2) - with no branch, so the compiler can vectorize it as well
+	for( ; i < n; ++ i )
+		vals[ i ] += valid[ i ] ? v : 0;
+}
+
+// Appends str to all strings of the batch
+export inline void append_to_strs( TPayloadBatch & b, std::string_view str )
+{
+	for( std::size_t i {}; i < b.size(); ++ i )
+		if( b.fValid[ i ] )
+			b.fStrs[ i ] += str;
+}
+
+
+
+
+// The scalar stage run for each object of the batch
+export template < ScalarStage F >
+class TLiftedStage
+{
+
+public:
+
+	constexpr explicit TLiftedStage( F f ) : fFun( std::move( f ) ) {}
+
+	void operator () ( TPayloadBatch & b )
+	{
+		for( std::size_t i {}; i < b.size(); ++ i )
+			b.put( i, std::invoke( fFun, b.take( i ) ) );
+	}
+
+private:
+
+	F		fFun;
+
+};
+
+export template < typename F >
+requires ScalarStage< std::decay_t< F > >
+constexpr auto lift( F && f ) -> TLiftedStage< std::decay_t< F > >
+{
+	return TLiftedStage< std::decay_t< F > >( std::forward< F >( f ) );
+}
+
+
+
+
+// A few kernels run one after another on the same batch - all kept with their own types
+export template < BatchKernel ... Kernels >
+class TBatchStage
+{
+
+public:
+
+	constexpr explicit TBatchStage( Kernels ... kernels ) : fKernels( std::move( kernels ) ... ) {}
+
+	void operator () ( TPayloadBatch & b )
+	{
+		std::apply( [ & b ]( auto & ... k ) { ( std::invoke( k, b ), ... ); }, fKernels );
+	}
+
+	std::tuple< Kernels ... > && kernels() && { return std::move( fKernels ); }
+
+private:
+
+	std::tuple< Kernels ... >		fKernels;
+
+	static_assert( sizeof ... ( Kernels ) > 0 );
+
+};
+
+
+
+// Two batch stages one after another make one stage with the kernels of both,
+// so the batch is converted to the SoA form (and back) only once for all of them
+export template < typename ... Kernels, typename ... Others >
+constexpr auto operator | ( TBatchStage< Kernels ... > && a, TBatchStage< Others ... > b ) -> TBatchStage< Kernels ..., Others ... >
+{
+	return std::make_from_tuple< TBatchStage< Kernels ..., Others ... > >( std::tuple_cat( std::move( a ).kernels(), std::move( b ).kernels() ) );
+}
+
+
+
+// Tells the pipe that the stage gets the whole batch - so the batch stages are fused only with
+// the batch stages, and the scalar ones only with the scalar ones, never one chain of both
+export template < typename F >
+inline constexpr bool is_batch_stage_v = false;
+
+template < typename ... Kernels >
+inline constexpr bool is_batch_stage_v< TBatchStage< Kernels ... > > = true;
+
+
+
+// The batch kernel as it is, and the scalar stage lifted
+template < typename F >
+constexpr auto AsKernel( F && f )
+{
+	if constexpr( BatchKernel< std::decay_t< F > > )
+		return std::decay_t< F >( std::forward< F >( f ) );
+	else
+		return lift( std::forward< F >( f ) );
+}
+
+// Makes the batch stage out of the kernels and the scalar stages
+export template < typename ... Funs >
+requires ( sizeof ... ( Funs ) > 0 ) && ( ( BatchKernel< std::decay_t< Funs > > || ScalarStage< std::decay_t< Funs > > ) && ... )
+constexpr auto batch( Funs && ... funs )
+{
+	return TBatchStage< decltype( AsKernel( std::forward< Funs >( funs ) ) ) ... >( AsKernel( std::forward< Funs >( funs ) ) ... );
+}
+
+
+
@@ -13,6 +13,7 @@
 #include <algorithm>
 
 #include <numeric>
+#include <cmath>
 #include <cassert>
 
 #include <functional>
@@ -24,244 +25,476 @@
 #include <random>
 #include <print>
 
-#include <queue> 
-#include <mutex> 
-#include <condition_variable>
+#include <memory> 
+#include <span> 
+#include <thread> 
+#include <atomic> 
+#include <latch> 
+#include <future>
+#include <chrono>
+#include <stop_token>
+#include <iterator>
+#include <memory_resource>
+#include <optional>
 
 
 import payload;
+import synchro_queue;
+import thread_pool;
+import async_queue;
+import pipe_stage;
+import batch_stage;
+import pipe_stats;
+import parallel_pipe;
+import payload_stages;
+import vectors_pipe;
+
 
 // ===================================================================
 
- 
+// The operators | of the parallel pipe are in the parallel_pipe module, and add_2, add_3, ... in payload_stages
 
 
 
 
+void NB_ParallelPipelineTest()
+{
+	NB_PayloadOrError_Queue_SS		theFirstQueue( std::make_shared< NB_PayloadOrError_Queue >() );
 
-// -----------------------------------------------------------
+	// add_2, add_3 and add_2 are fused into one thread, and the sink prints the objects as soon as they leave it
+	auto thePipe = theFirstQueue | add_2 | add_3 | add_2 | sink( []( PayloadOrError && e ) { if( e ) std::println( "fStr = {}", e->fStr ); } );
 
+	thePipe.on_done( []() { std::println( "The end of the data" ); } );
 
-template < typename Elem >
-class TSynchroQueue
+	// Here the above pipeline is already running and waiting for the objects to process
+	theFirstQueue->push( Payload{ "The quick", 5 } );
+	theFirstQueue->push( Payload{ "brown", 6 } );
+	theFirstQueue->push( Payload{ "fox", 7 } );
+	theFirstQueue->close();		// this is our communication with the threads - the end of the data
+
+	// No polling - we wake up as soon as the sink has processed the last object
+	using namespace std::chrono_literals;
+	if( not thePipe.wait_for( 5s ) )
+		std::println( "The pipe is still running - something is wrong" );
+}
+
+
+
+// The same pipe but joined with the lock-free SPSC queues.
+// Here the main thread is the only producer to the first queue
+// and the only consumer of the last one.
+void NB_SpscPipelineTest()
 {
+	NB_PayloadOrError_SpscQueue_SS		theFirstQueue( std::make_shared< NB_PayloadOrError_SpscQueue >() );
 
-public:
+	auto out_q_SS = ( theFirstQueue | add_2 | split() | add_3 | split() | add_2 ).run();		// three threads - operator | picks the SPSC queues for all of them
 
-	using value_type = Elem;
+	theFirstQueue->push( Payload{ "The quick", 5 } );
+	theFirstQueue->push( Payload{ "brown", 6 } );
+	theFirstQueue->push( Payload{ "fox", 7 } );
+	theFirstQueue->push( Payload{ "STOP!", 13 } );		// no special meaning - this is just the data
+	theFirstQueue->close();
+
+	// pop blocks until the next object leaves the pipe
+	for( auto ret_e = out_q_SS->pop(); ret_e; ret_e = out_q_SS->pop() )		// until the pipe is closed and drained
+		std::println( "fStr = {}", ret_e->value().fStr );
+
+	std::println( "The end of the data" );
+}
+
+
+
+// Emulates a stage that is much slower than the producer
+auto slow_add_1( PayloadOrError && a )
+{
+	using namespace std::chrono_literals;
+	std::this_thread::sleep_for( 20ms );
+
+	if( a )
+		a->fStr += "_1",	a->fVal += 1;
+	return std::move( a );
+}
 
-	using ExpectedElem = std::expected< Elem, bool >;		// TO DO: change bool to enum and add some STOP conditions for the pipeline to stop processing
 
-public:
+// The queues are bounded, so the fast producer is throttled by the slow stage,
+// rather than filling the memory with the waiting objects
+void NB_BoundedPipelineTest()
+{
+	constexpr std::size_t	kQueueCapacity { 2 };
 
-	void push( Elem && in_elem )
+	NB_PayloadOrError_Queue_SS		theFirstQueue( std::make_shared< NB_PayloadOrError_Queue >( kQueueCapacity ) );
+
+	auto out_q_SS = ( theFirstQueue | slow_add_1 | split() | add_2 ).run();		// all queues inherit kQueueCapacity
+
+	// The producer runs in its own thread, since the whole pipe holds only a few objects at a time
+	std::jthread	theProducer( [ theFirstQueue ]()
 	{
+		using namespace std::chrono_literals;
+
+		for( int i {}; i < 8; ++ i )
 		{
-			std::unique_lock	theLock( fMutex );
-			fQueue.emplace( in_elem );
+			PayloadOrError	p { MakePayload( "item_" + std::to_string( i ), i ) };	// not Payload - it would be moved into a temporary even if try_push fails
+
+			if( theFirstQueue->try_push( std::move( p ) ) )
+				continue;
+
+			std::println( "queue full - the producer waits" );
+
+			if( not theFirstQueue->push_for( std::move( p ), 100ms ) )
+				theFirstQueue->push( std::move( p ) );		// still full - wait as long as necessary
 		}
 
-		fCondVar.notify_one();	// we call notify_one when the mutex is already released - otherwise the notified thread
-	}									// can be woken up only to try to lock still locked mutex
+		theFirstQueue->close();
+	} );
+
+	for( auto ret_e = out_q_SS->pop(); ret_e; ret_e = out_q_SS->pop() )		// until the pipe is closed and drained
+		std::println( "fStr = {}", ret_e->value().fStr );
+
+	std::println( "The end of the data" );
+}
+
+
+
+// Abort - the consumer takes a few objects and stops the whole pipe.
+// The producer never ends the data by itself - it learns that the pipe is cancelled from its queue.
+void NB_CancelPipelineTest()
+{
+	NB_PayloadOrError_Queue_SS		theFirstQueue( std::make_shared< NB_PayloadOrError_Queue >( 4 ) );
 
-	ExpectedElem pop( void )
+	auto out_q_SS = ( theFirstQueue | slow_add_1 | add_2 ).run();
+
+	std::jthread	theProducer( [ theFirstQueue ]()
 	{
-		std::unique_lock	theLock( fMutex );
-
-		//if( fQueue.empty() )
-		//	return ExpectedElem( std::unexpected( false ) );
-
-		// Block waiting until the queue is not empty
-		// std::condition_variable operates only with std::unique_lock<std::mutex>
-		// This is the key point - if I'm here then I possessed the mutex. However, if I stay here we ALL WOULD BE BLOCKED,
-		// since no other thread can push anything to this queue. The solution is to give up my thread and realease the mutex
-		// until the condition is true - in this case, this is that the queue is not longer empty.
-		fCondVar.wait( theLock, [ this ]() { return not fQueue.empty(); } );	
-
-		// OK, we have something to pop and to return
-		auto out_elem = fQueue.front();
-		fQueue.pop();
-		return ExpectedElem( out_elem );
-	}
+		for( int i {}; not theFirstQueue->is_cancelled(); ++ i )
+			theFirstQueue->push( MakePayload( "item_" + std::to_string( i ), i ) );		// woken up by cancel() if waits on the full queue
+	} );
 
-	// This is not thread safe!
-	auto size() const { return fQueue.size(); }
+	for( int i {}; i < 3; ++ i )
+		if( auto ret_e = out_q_SS->pop(); ret_e )
+			std::println( "fStr = {}", ret_e->value().fStr );
 
-public:
+	out_q_SS.cancel();		// the stop is requested on all stages - what is still in the queues is dropped
+	out_q_SS.join();
 
-	// This blocks also creation of the copy and move constructors, as well as the copy assignment.
-	// However, the default constructor and destructor are created by the compiler.
-	// See the book by N. Jousuttis.
-	TSynchroQueue & operator = ( TSynchroQueue && ) = delete;
+	const auto ret_e = out_q_SS->pop();
+	std::println( "The pipe is {}", not ret_e && ret_e.error() == EQueueErr::kCancelled ? "cancelled" : "still running" );
+}
 
-private:
 
-	std::queue< Elem >			fQueue;
 
-	std::mutex						fMutex;
+// Emulates a CPU-heavy stage - the time depends on the object
+auto heavy_add_5( PayloadOrError && a )
+{
+	if( a )
+	{
+		std::this_thread::sleep_for( std::chrono::milliseconds( 10 * ( a->fVal % 4 ) ) );
+		a->fStr += "_5",	a->fVal += 5;
+	}
+	return std::move( a );
+}
 
-	std::condition_variable		fCondVar;
 
+// The bottleneck stage is run by 4 threads
+void NB_ReplicatedPipelineTest()
+{
+	PayloadMemory		thePayloadMemory;		// the first - it must outlive all the objects of the pipes
 
+	NB_PayloadOrError_Queue_SS		theFirstQueue( std::make_shared< NB_PayloadOrError_Queue >() );
 
-};
+	auto out_q_SS = ( theFirstQueue | add_2 | parallel( 4, heavy_add_5 ) | add_3 ).run();
 
+	// The same but the order is preserved
+	NB_PayloadOrError_Queue_SS		theOrderedQueue( std::make_shared< NB_PayloadOrError_Queue >() );
 
+	auto ordered_out_q_SS = ( theOrderedQueue | add_2 | ordered_parallel( 4, heavy_add_5 ) | add_3 ).run();
 
+	for( auto & in_q : { theFirstQueue, theOrderedQueue } )
+	{
+		for( int i {}; i < 12; ++ i )
+			in_q->push( MakePayload( "item_" + std::to_string( i ), i, & thePayloadMemory ) );
+		in_q->close();
+	}
 
+	for( auto & out_q : { out_q_SS.out_queue(), ordered_out_q_SS.out_queue() } )
+	{
+		std::println( out_q == out_q_SS.out_queue() ? "parallel:" : "ordered_parallel:" );
 
-using PaylodOrErrorProcFun = std::function< PayloadOrError ( PayloadOrError && in_elem ) >;
+		for( auto ret_e = out_q->pop(); ret_e; ret_e = out_q->pop() )
+			std::println( "fStr = {}", ret_e->value().fStr );
 
+		std::println( "The end of the data" );
+	}
+}
 
 
 
 
-using NB_PayloadOrError_Queue = TSynchroQueue< PayloadOrError >;
+// The stats show which stage is the bottleneck - slow_add_1, even though it is not the slowest
+// function in the pipe (heavy_add_5 is, but it is run by 4 threads)
+void NB_InstrumentedPipelineTest()
+{
+	auto theStats = std::make_shared< TPipeStats >();
 
-using NB_PayloadOrError_Queue_SS = std::shared_ptr< NB_PayloadOrError_Queue >;
+	NB_PayloadOrError_Queue_SS		theFirstQueue( std::make_shared< NB_PayloadOrError_Queue >( 16 ) );
+	theFirstQueue->set_stats( theStats );		// the queues and the stages joined to it are instrumented
 
+	auto thePipe = theFirstQueue | add_2 | split() | slow_add_1 | parallel( 4, heavy_add_5 ) | add_3 | sink( []( PayloadOrError && ) {} );
 
+	{
+		using namespace std::chrono_literals;
+		TStatsReporter		theReporter( theStats, 200ms );		// prints the stats as text, and once again at the end
 
+		for( int i {}; i < 24; ++ i )
+			theFirstQueue->push( MakePayload( "item_" + std::to_string( i ), i ) );
+		theFirstQueue->close();
 
-template< typename Elem >
-using NB_ParallelPipeFun = std::function< void ( TSynchroQueue< Elem > & in_q, TSynchroQueue< Elem > & out_q ) >;
+		thePipe.wait();
+	}
 
-using NB_ParallelPipeFun_4_PayloadOrError = NB_ParallelPipeFun< PayloadOrError >;
+	std::println( "{}", theStats->to_json() );
+}
 
 
-using namespace std::string_view_literals;
-constexpr	auto		kStopToken			{ "STOP!"sv };
 
 
-void		NB_ParPipe_Fun_Loop( NB_PayloadOrError_Queue_SS in_q, NB_PayloadOrError_Queue_SS out_q, PaylodOrErrorProcFun && theCartridgeFun )
+// A deep pipe run by a few threads of the pool - no matter how many stages
+void NB_PooledPipelineTest()
 {
-	auto th_id = std::this_thread::get_id();
+	TWorkStealingPool		thePool;		// the first one - to be destroyed after all the stages
 
-	for( ;; )
-	{
+	constexpr int	kNumOfStages { 30 };
 
-		auto pop_elem_or_none = in_q->pop();
-		//if( not pop_elem_or_none )
-		//{
-		//	using namespace std::chrono_literals;
-		//	std::this_thread::sleep_for( 200ms );
-		//	continue;
-		//}
+	NB_PayloadOrError_Queue_SS		theFirstQueue( std::make_shared< NB_PayloadOrError_Queue >() );
 
-		assert( pop_elem_or_none );
+	auto out_q_SS = theFirstQueue;
+	for( int i {}; i < kNumOfStages; ++ i )
+		out_q_SS = std::move( out_q_SS ) | pooled( thePool, i % 2 ? add_3 : add_2 );
 
-		if( pop_elem_or_none->value().fStr == kStopToken )
-		{
-			out_q->push( std::move( pop_elem_or_none->value() ) );		// pass the STOP token
-			break;																		// and exit the thread
-		}
-		else
-		{
-			//PayloadOrError outElem;
-			//theCartridgeFun( * pop_elem_or_none, outElem );		// do some action with the pop'ed element
-			auto outElem = theCartridgeFun( std::move( * pop_elem_or_none ) );		// do some action with the pop'ed element
-			out_q->push( std::move( outElem ) );
-		}
+	std::println( "{} stages run by {} threads", kNumOfStages, thePool.size() );
 
-	}
+	theFirstQueue->push( Payload{ "The quick", 5 } );
+	theFirstQueue->push( Payload{ "brown", 6 } );
+	theFirstQueue->push( Payload{ "fox", 7 } );
+	theFirstQueue->close();
+
+	for( auto ret_e = out_q_SS->pop(); ret_e; ret_e = out_q_SS->pop() )		// until the pipe is closed and drained
+		std::println( "fVal = {}", ret_e->value().fVal );
 
+	std::println( "The end of the data" );
 }
 
 
 
-auto operator | ( NB_PayloadOrError_Queue_SS in_queue, PaylodOrErrorProcFun && f ) -> NB_PayloadOrError_Queue_SS
+// An example of the coroutine stage - it passes only every second object
+TAsyncTask	skip_odd( NB_PayloadOrError_AsyncQueue_SS in_q, NB_PayloadOrError_AsyncQueue_SS out_q )
 {
-	NB_PayloadOrError_Queue_SS		out_queue_sp( std::make_shared< NB_PayloadOrError_Queue >() );
+	co_await resume_on( in_q->pool() );
 
-	std::jthread	theThread( NB_ParPipe_Fun_Loop, in_queue, out_queue_sp, std::move( f ) );
-	auto th_id = theThread.get_id();
-	theThread.detach();	// Let it run separately
+	for( bool odd {}; auto pop_elem = co_await in_q->pop_async(); odd = not odd )		// until in_q is closed
+		if( not odd )
+			out_q->push( std::move( * pop_elem ) );
 
-	return out_queue_sp;
+	out_q->close();
+}
 
+
+// The sink - sums up fVal and counts down when the queue is closed
+TAsyncTask	sum_up( NB_PayloadOrError_AsyncQueue_SS in_q, std::atomic< long long > & sum, std::latch & done )
+{
+	for( auto pop_elem = co_await in_q->pop_async(); pop_elem; pop_elem = co_await in_q->pop_async() )
+		if( auto & elem = * pop_elem; elem )
+			sum += elem->fVal;
+
+	done.count_down();
 }
 
 
-auto add_2( PayloadOrError && a )
+// Many independent pipes, e.g. one per client stream, run by the threads of one pool.
+// There are 4 stages in each pipe, but only a few threads in total.
+void NB_AsyncPipelinesTest()
 {
-	auto b { a };
-	if( b ) 
-		b->fStr += "_2", b->fVal += 2;
-	return b;
+	TWorkStealingPool		thePool;		// the first one - to be destroyed after all the pipes
+
+	constexpr int	kNumOfPipes { 1000 };
+
+	std::atomic< long long >	theSum {};
+	std::latch						allDone( kNumOfPipes );
+
+	std::vector< NB_PayloadOrError_AsyncQueue_SS >		theInQueues;
+
+	for( int i {}; i < kNumOfPipes; ++ i )
+	{
+		auto in_q = std::make_shared< NB_PayloadOrError_AsyncQueue >( thePool );
+
+		sum_up( in_q | add_2 | skip_odd | add_3, theSum, allDone );
+
+		theInQueues.push_back( std::move( in_q ) );
+	}
+
+	for( auto & in_q : theInQueues )
+	{
+		for( int v {}; v < 4; ++ v )
+			in_q->push( Payload { "item", v } );		// only v == 0 and v == 2 get through skip_odd
+		in_q->close();
+	}
+
+	allDone.wait();
+
+	std::println( "{} pipes run by {} threads, sum = {} (expected {})", kNumOfPipes, thePool.size(), theSum.load(), kNumOfPipes * ( 0 + 2 + 2 * ( 2 + 3 ) ) );
 }
 
 
-auto add_3( PayloadOrError && a )
+
+// The stages of the serial pipe of the vectors (see the vectors_pipe module), but in two threads - the reading
+// (path -> vectors -> normalized) and the computing (distances -> the most similar pair). The queues are the lock-free SPSC ones.
+void NB_TypedPipelineTest()
 {
-	auto b { a };
-	if( b )
-		b->fStr += "_3",	b->fVal += 3;
-	return b;
+	using namespace VectorsPipeTest;
+
+	auto theFirstQueue = std::make_shared< TSpscRingQueue< path_exp > >();
+
+	// Here the last queue is deduced as TSpscRingQueue< max_exp >, and the sink takes from it
+	auto thePipe =	theFirstQueue 
+					| []( path_exp && pe ) { return load_paths( std::move( pe ), "txt" ); }
+					| load_vectors 
+					| vec_normalize 
+					| split()
+					| comp_distance 
+					| find_max 
+					| sink( []( max_exp && me )
+					{
+						if( me )
+						{
+							auto [ x, y, v ] = * me;
+							std::println( "success @ idx=({},{}; val={:.3f})", x, y, v );
+						}
+						else
+						{
+							std::println( "DistErr #{}", static_cast< int >( me.error() ) );
+						}
+					} );
+
+	auto theDone = thePipe.get_future();
+
+	theFirstQueue->push( path_exp { ".\\..\\data" } );
+	theFirstQueue->push( path_exp { "no_such_dir" } );						// the error goes down the pipe
+	theFirstQueue->push( std::unexpected( PathErr::kEmpty ) );
+	theFirstQueue->close();		// no more data
+
+	theDone.wait();
 }
 
 
-void NB_ParallelPipelineTest()
+
+// Five stage functions but only two threads - the stages are fused up to split()
+void NB_FusedPipelineTest()
 {
 	NB_PayloadOrError_Queue_SS		theFirstQueue( std::make_shared< NB_PayloadOrError_Queue >() );
 
+	auto add_10 = []( PayloadOrError && a ) 
+	{ 
+		if( a )
+			a->fStr += "_10", a->fVal += 10;
+		return std::move( a );
+	};
+
+	auto out_q_SS = ( theFirstQueue | fn< add_2 > | fn< add_3 > | fn< add_2 > | split() | fuse( add_10, fn< add_3 > ) ).run();		// fn< f > - a direct call
+
 	theFirstQueue->push( Payload{ "The quick", 5 } );
 	theFirstQueue->push( Payload{ "brown", 6 } );
 	theFirstQueue->push( Payload{ "fox", 7 } );
-	theFirstQueue->push( Payload{ std::string( kStopToken ), 13});		// this is our custom communication with the threads
+	theFirstQueue->close();
 
-	auto init_size = theFirstQueue->size();
+	for( auto ret_e = out_q_SS->pop(); ret_e; ret_e = out_q_SS->pop() )		// until the pipe is closed and drained
+		std::println( "fStr = {}, fVal = {}", ret_e->value().fStr, ret_e->value().fVal );
 
+	std::println( "The end of the data" );
+}
 
-	std::println( "init_size = {}", init_size );
 
 
-	NB_PayloadOrError_Queue_SS zeroQueue( std::make_shared< NB_PayloadOrError_Queue >() );
+// The stage of the small payloads - there is no room to grow the inline string, then it is the error
+SmallPayloadOrError small_add_2( SmallPayloadOrError && a )
+{
+	if( a && not a->fStr.append( "_2" ) )
+		return std::unexpected( OpErrorType::kOverflow );
 
+	if( a )
+		a->fVal += 2;
+	return std::move( a );
+}
 
-	auto out_q_SS = theFirstQueue | add_2 | add_3 | add_2;
-	//uto out_q_SS = zeroQueue | add_2 | add_3 | add_2;
 
-	// Here the above pipeline is already running and waiting for the objects to process
-	// This is done in the following loop - objects from theFirstQueue are moved to zeroQueue
-
-	for( ; out_q_SS->size() < init_size; )
-	{
-		using namespace std::chrono_literals;
-		std::this_thread::sleep_for( 200ms );		// emulate some actions
-	
-		if( theFirstQueue->size() > 0 )			// theFirstQueue is served only by the main thread
-			if( auto elem = theFirstQueue->pop(); elem )
-				zeroQueue->push( elem->value() );
-	}
+// The short tags kept in the objects - the typed pipe takes them as any other std::expected.
+// Then, the same work on a batch of PayloadOrError in the structure-of-arrays form.
+void NB_SmallPayloadPipelineTest()
+{
+	std::println( "sizeof( SmallPayloadOrError ) = {}, sizeof( PayloadOrError ) = {}", sizeof( SmallPayloadOrError ), sizeof( PayloadOrError ) );
 
-	// If here, then all objects are in the pipeline and processed by the threads.
-	// In the following loop we process whatever is available on the out queue.
+	auto theFirstQueue = std::make_shared< TSynchroQueue< SmallPayloadOrError > >();
 
-	for( ; out_q_SS->size() > 0; )
+	auto thePipe = theFirstQueue | small_add_2 | small_add_2 | sink( []( SmallPayloadOrError && e )
 	{
-		auto ret_e = out_q_SS->pop();
-		if( ret_e )
-			if( const auto & s = ret_e->value().fStr; s == kStopToken )
-				std::println( "The STOP token detected" );
-			else
-				std::println( "fStr = {}", s );
-	}
-
+		if( e )
+			std::println( "fStr = {}, fVal = {}", e->fStr.view(), e->fVal );
+		else
+			std::println( "error #{}", static_cast< int >( e.error() ) );
+	} );
 
-}
+	theFirstQueue->push( SmallPayload { "The quick", 5 } );
+	theFirstQueue->push( SmallPayload { "jumps over the lazy", 6 } );		// 19 + 4 chars - just fits
+	theFirstQueue->push( SmallPayload { "jumps over the lazy dog", 7 } );	// too long after the first stage
+	theFirstQueue->close();
 
+	thePipe.wait();
 
 
+	// One loop over the column of the values, rather than a call per object
+	std::vector< PayloadOrError >		theObjects;
+	theObjects.push_back( Payload { "brown", 1 } );
+	theObjects.push_back( std::unexpected( OpErrorType::kUnderflow ) );
+	theObjects.push_back( Payload { "fox", 2 } );
 
+	TPayloadBatch		theBatch;
+	theBatch.assign( theObjects );
 
+	for( std::size_t i {}; i < theBatch.size(); ++ i )
+		theBatch.fVals[ i ] += theBatch.fValid[ i ] ? 2 : 0;		// no branch - the errors get 0
 
+	theObjects.clear();
+	theBatch.move_to( theObjects );
 
+	for( const auto & e : theObjects )
+		if( e )
+			std::println( "fStr = {}, fVal = {}", e->fStr, e->fVal );
+		else
+			std::println( "error #{}", static_cast< int >( e.error() ) );
+}
 
 
 
+// The batch stages - the kernels run on the whole batch, and the scalar add_3 is lifted
+void NB_BatchPipelineTest()
+{
+	NB_PayloadOrError_Queue_SS		theFirstQueue( std::make_shared< NB_PayloadOrError_Queue >() );
 
+	auto thePipe = theFirstQueue | batch( add_2_batch, add_3 ) | add_2 | batch( add_3_batch ) | sink( []( PayloadOrError && e )
+	{
+		if( e )
+			std::println( "fStr = {}, fVal = {}", e->fStr, e->fVal );
+		else
+			std::println( "error #{}", static_cast< int >( e.error() ) );
+	} );
 
+	for( int i {}; i < 12; ++ i )
+		if( i % 5 == 4 )
+			theFirstQueue->push( std::unexpected( OpErrorType::kInvalidInput ) );		// the errors go through untouched
+		else
+			theFirstQueue->push( MakePayload( "item_" + std::to_string( i ), i ) );
+	theFirstQueue->close();
 
+	thePipe.wait();
+}
 
 
 
@@ -0,0 +1,202 @@
+// ---------------------------------------------------
+// Created by Boguslaw Cyganek (C) 2024
+// ---------------------------------------------------
+
+
+export module dense_matrix;
+
+
+
+
+import <cstddef>;
+import <cassert>;
+import <new>;
+import <span>;
+import <vector>;
+import <algorithm>;
+import <concepts>;
+import <expected>;
+import <numeric>;
+import <cmath>;
+
+
+
+// -----------------------------------------------------------
+// The dense matrix - all elements in one block of memory, row after row.
+// The vector of vectors has one allocation per row, and its rows lie anywhere,
+// so a loop over the rows jumps from one place in the memory to another. Here there
+// is one allocation, and each row starts at the address aligned to Align bytes
+// (the rows are padded with zeros up to stride() elements), so it can be read with
+// the aligned SIMD loads. A row is a std::span of cols() elements.
+// Examples:
+//
+//		TDenseMatrix< double >	m( 3, 5 );
+//		m( 1, 2 ) = 3.14;
+//		for( auto & x : m.row( 1 ) )
+//			x *= 2.0;
+//
+
+
+
+
+// The allocator of the memory aligned to Align bytes
+export template < typename T, std::size_t Align >
+struct TAlignedAllocator
+{
+	using value_type = T;
+
+	static_assert( Align >= alignof( T ) && ( Align & ( Align - 1 ) ) == 0, "Align must be a power of 2" );
+
+	template < typename U >
+	struct rebind { using other = TAlignedAllocator< U, Align >; };
+
+	constexpr TAlignedAllocator() noexcept = default;
+
+	template < typename U >
+	constexpr TAlignedAllocator( const TAlignedAllocator< U, Align > & ) noexcept {}
+
+	T * allocate( std::size_t n )
+	{
+		return static_cast< T * >( ::operator new( n * sizeof( T ), std::align_val_t { Align } ) );
+	}
+
+	void deallocate( T * p, std::size_t n ) noexcept
+	{
+		::operator delete( p, n * sizeof( T ), std::align_val_t { Align } );
+	}
+
+	template < typename U >
+	friend constexpr bool operator == ( const TAlignedAllocator &, const TAlignedAllocator< U, Align > & ) noexcept { return true; }
+};
+
+
+
+
+export template < std::floating_point T, std::size_t Align = 64 >		// 64 - the cache line, and the AVX-512 register
+class TDenseMatrix
+{
+
+public:
+
+	using value_type	= T;
+	using size_type	= std::size_t;
+
+	static constexpr size_type	kAlign { Align };
+
+	// The number of elements in Align bytes - the stride is its multiple
+	static constexpr size_type	kRowPad { Align / sizeof( T ) };
+
+	static_assert( Align % sizeof( T ) == 0 );
+
+public:
+
+	TDenseMatrix() = default;
+
+	TDenseMatrix( size_type rows, size_type cols, T init = T {} )
+		: fRows( rows ), fCols( cols ), fStride( RoundUp( cols ) ), fData( rows * fStride, T {} )
+	{
+		if( init != T {} )
+			for( size_type r {}; r < fRows; ++ r )
+				std::ranges::fill( row( r ), init );		// the padding stays 0
+	}
+
+public:
+
+	size_type rows() const { return fRows; }
+	size_type cols() const { return fCols; }
+
+	// The distance (in elements) from one row to the next one
+	size_type stride() const { return fStride; }
+
+	bool empty() const { return fRows == 0; }
+
+	T * data() { return fData.data(); }
+	const T * data() const { return fData.data(); }
+
+	std::span< T > row( size_type r )
+	{
+		assert( r < fRows );
+		return { fData.data() + r * fStride, fCols };
+	}
+
+	std::span< const T > row( size_type r ) const
+	{
+		assert( r < fRows );
+		return { fData.data() + r * fStride, fCols };
+	}
+
+	T & operator () ( size_type r, size_type c )
+	{
+		assert( r < fRows && c < fCols );
+		return fData[ r * fStride + c ];
+	}
+
+	const T & operator () ( size_type r, size_type c ) const
+	{
+		assert( r < fRows && c < fCols );
+		return fData[ r * fStride + c ];
+	}
+
+public:
+
+	// Appends a row at the end. The first row sets the number of columns (if the matrix has none) -
+	// the next ones must be of the same length, otherwise false is returned and the matrix is left untouched.
+	bool push_row( std::span< const T > v )
+	{
+		if( fRows == 0 && fCols == 0 )
+			fCols = v.size(), fStride = RoundUp( fCols );
+
+		if( v.size() != fCols )
+			return false;
+
+		fData.resize( fData.size() + fStride, T {} );
+		std::ranges::copy( v, fData.end() - fStride );
+		++ fRows;
+		return true;
+	}
+
+private:
+
+	static constexpr size_type RoundUp( size_type cols ) { return ( cols + kRowPad - 1 ) / kRowPad * kRowPad; }
+
+private:
+
+	size_type		fRows {};
+	size_type		fCols {};
+	size_type		fStride {};
+
+	std::vector< T, TAlignedAllocator< T, Align > >		fData;
+
+};
+
+
+
+
+// Normalizes v in place to the unit E2 length, e.g. a row of TDenseMatrix:
+//
+//		for( std::size_t r {}; r < m.rows(); ++ r )
+//			if( auto res = normalize_row( m.row( r ) ); ! res )
+//				return res.error();
+//
+export enum class ENormErr { kEmptyVec, kZeroSum, kWrongVals };
+
+export template < std::floating_point T, auto kThresh = 1e-76 >
+auto normalize_row( std::span< T > v ) -> std::expected< void, ENormErr >
+{
+	if( not v.size() )
+		return std::unexpected( ENormErr::kEmptyVec );
+
+	auto denom = std::inner_product( v.begin(), v.end(), v.begin(), T() );
+
+	if( denom < kThresh )	// check the denominator
+		return std::unexpected( ENormErr::kZeroSum );
+	else if( std::isinf( denom ) || std::isnan( denom ) )
+		return std::unexpected( ENormErr::kWrongVals );
+
+	std::ranges::transform( v, v.begin(), [ sq = std::sqrt( denom ) ] ( auto x ) { return x / sq; } );
+	return {};
+}
+
+
+
+
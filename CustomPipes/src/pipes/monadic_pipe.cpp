@@ -28,6 +28,11 @@
 
 #include <variant>
 #include <ranges>
+#include <span>
+
+
+import dense_matrix;
+import similarity;
 
 
 using namespace std::literals;
@@ -46,38 +51,14 @@ namespace Monadic_VectorsPipeTest
 {
 
 
-	enum class ENormErr { kEmptyVec, kZeroSum, kWrongVals };
-
-	template < typename T, template < typename > typename Cont = std::vector >
-	using NormExpected = std::expected< Cont< T >, ENormErr >; 
-
-	// Takes an FP vector and returns its normalized E2 version
-	// Good only for floating-point types
-	template <	std::floating_point T, 
-					template < typename > typename Cont = std::vector, 
-					auto kThresh = 1e-76 >
-	auto normalize( Cont< T > v ) -> NormExpected< T, Cont >
-	{
-		if( not v.size() )
-			return std::unexpected( ENormErr::kEmptyVec );
-
-		auto denom = std::inner_product( v.begin(), v.end(), v.begin(), decltype( v )::value_type() );
-
-		if( denom < kThresh )	// check the denominator
-			return std::unexpected( ENormErr::kZeroSum );
-		else if( std::isinf( denom ) || std::isnan( denom ) )
-			return std::unexpected( ENormErr::kWrongVals );
-
-		std::transform( v.begin(), v.end(), v.begin(), [ sq = std::sqrt( denom ) ] ( auto x ) { return x / sq; } );
-		return v;
-	}
+	using ::ENormErr;				// see the dense_matrix module
+	using ::normalize_row;
 
 
 	using DType = double;		
 	using DVec = std::vector< DType >;		
-	using VecOfVec = std::vector< DVec >;
 
-	using Matrix = VecOfVec;
+	using Matrix = TDenseMatrix< DType >;		// one vector per row, all in one block of memory
 
 	using PathVec = std::vector< std::filesystem::path >;
 
@@ -86,7 +67,7 @@ namespace Monadic_VectorsPipeTest
 
 
 
-	using vec_vec_exp = std::expected< VecOfVec, ENormErr >;
+	using vec_vec_exp = std::expected< Matrix, ENormErr >;
 
 	enum class DistErr { kZeroLen, kWrongData };
 	using dist_exp = std::expected< Matrix, DistErr >;
@@ -104,9 +85,10 @@ namespace Monadic_VectorsPipeTest
 
 	using path_com_exp		= std::expected< std::filesystem::path,	common_errors >;
 	using load_com_exp		= std::expected< PathVec,						common_errors >;
-	using vec_vec_com_exp	= std::expected< VecOfVec,						common_errors >;
+	using vec_vec_com_exp	= std::expected< Matrix,						common_errors >;
 	using dist_com_exp		= std::expected< Matrix,						common_errors >;
 	using max_com_exp			= std::expected< index_val,					common_errors >;
+	using nearest_com_exp	= std::expected< TNearest,						common_errors >;
 
 
 	// traverse and collect all paths in this directory of files with the "accept_ext" extension
@@ -148,8 +130,9 @@ namespace Monadic_VectorsPipeTest
 	// open all files and read the vectors 
 	vec_vec_exp load_vectors( PathVec && le )
 	{
-		// open each file and read vectors
-		VecOfVec	retVecs;
+		// open each file and read vectors - each becomes a row of the matrix
+		Matrix	retVecs;
+		DVec		theVec;		// the vector of one line - reused, so there is no allocation per line
 		for( const auto & f : le )
 		{
 			if( std::ifstream inFile( f ); inFile.is_open() )
@@ -159,19 +142,24 @@ namespace Monadic_VectorsPipeTest
 					std::istringstream istr( str );
 					using DType_Iter = std::istream_iterator< DType >;
 
-					retVecs.emplace_back(	std::make_move_iterator( DType_Iter{ istr } ), 
-													std::make_move_iterator( DType_Iter{} ) );
+					theVec.assign( DType_Iter{ istr }, DType_Iter{} );
+
+					if( theVec.empty() )
+						return std::unexpected( ENormErr::kEmptyVec );
+					if( ! retVecs.push_row( theVec ) )
+						return std::unexpected( ENormErr::kWrongVals );		// all vectors must be of the same length
 				}
 			}
 		}
 
-		return retVecs.size() > 0 ? vec_vec_exp { retVecs } : std::unexpected( ENormErr::kEmptyVec );
+		return ! retVecs.empty() ? vec_vec_exp { std::move( retVecs ) } : std::unexpected( ENormErr::kEmptyVec );
 	}
 
 	vec_vec_com_exp load_vectors_common( PathVec && le )
 	{
-		// open each file and read vectors
-		VecOfVec	retVecs;
+		// open each file and read vectors - each becomes a row of the matrix
+		Matrix	retVecs;
+		DVec		theVec;		// the vector of one line - reused, so there is no allocation per line
 		for( const auto & f :le )
 		{
 			if( std::ifstream inFile( f ); inFile.is_open() )
@@ -181,55 +169,50 @@ namespace Monadic_VectorsPipeTest
 					std::istringstream istr( str );
 					using DType_Iter = std::istream_iterator< DType >;
 
-					retVecs.emplace_back(	std::make_move_iterator( DType_Iter{ istr } ), 
-													std::make_move_iterator( DType_Iter{} ) );
+					theVec.assign( DType_Iter{ istr }, DType_Iter{} );
+
+					if( theVec.empty() )
+						return std::unexpected( ENormErr::kEmptyVec );
+					if( ! retVecs.push_row( theVec ) )
+						return std::unexpected( ENormErr::kWrongVals );		// all vectors must be of the same length
 				}
 			}
 		}
 
-		return retVecs.size() > 0 ? vec_vec_exp { retVecs } : std::unexpected( ENormErr::kEmptyVec );
+		return ! retVecs.empty() ? vec_vec_exp { std::move( retVecs ) } : std::unexpected( ENormErr::kEmptyVec );
 	}
 
-	vec_vec_exp vec_normalize( VecOfVec && vve )	
+	vec_vec_exp vec_normalize( Matrix && vve )	
 	{
 
-		for( auto && v : vve )
-			if( auto env = normalize< DVec::value_type, std::vector >( v ); env.has_value() )
-				v = env.value();
-			else
+		for( Matrix::size_type r {}; r < vve.rows(); ++ r )
+			if( auto env = normalize_row( vve.row( r ) ); ! env.has_value() )
 				return std::unexpected( env.error() );		// stop immediately and pass the error out
 
-		return vve;
+		return std::move( vve );
 	}
 
-	vec_vec_com_exp vec_normalize_common( VecOfVec && vve )	
+	vec_vec_com_exp vec_normalize_common( Matrix && vve )	
 	{
-		for( auto && v : vve )
-			if( auto env = normalize< DVec::value_type, std::vector >( v ); env.has_value() )
-				v = env.value();
-			else
+		for( Matrix::size_type r {}; r < vve.rows(); ++ r )
+			if( auto env = normalize_row( vve.row( r ) ); ! env.has_value() )
 				return std::unexpected( env.error() );		// stop immediately and pass the error out
 
-		return vve;
+		return std::move( vve );
 	}
 
 
 	// Computes a cosine distance between vectors
 	// We assume that the input vectors are already normalized
-	dist_exp comp_distance( VecOfVec && vve )
+	dist_exp comp_distance( Matrix && vve )
 	{
-		const auto kColsRows { vve.size() };	// it's a square matrix
+		const auto kColsRows { vve.rows() };	// it's a square matrix
 		if( kColsRows == 0 )
 			return std::unexpected( DistErr::kZeroLen );
 
-		Matrix distances( kColsRows, DVec( kColsRows, DVec::value_type {} ) );
+		Matrix distances( kColsRows, kColsRows );
 
-		for( auto r { DVec::size_type {} }; r < kColsRows; ++ r )
-		{
-			const auto & v = ( vve )[ r ];
-			for( auto c { r + 1 }; c < kColsRows; ++ c )
-				distances[ r ][ c ] = std::inner_product( v.begin(), v.end(), ( vve )[ c ].begin(), std::remove_cvref_t< decltype(v) >::value_type {} );
-		}
+		gram_upper( vve, distances, SimilarityPool() );		// distances( r, c ) = vve.row( r ) . vve.row( c ) for c > r - blocked, with SIMD, by all cores
 
 		return distances;
 	}
@@ -237,20 +220,15 @@ namespace Monadic_VectorsPipeTest
 
 	// Computes a cosine distance between vectors
 	// We assume that the input vectors are already normalized
-	dist_com_exp comp_distance_common( VecOfVec && vve )
+	dist_com_exp comp_distance_common( Matrix && vve )
 	{
-		const auto kColsRows { vve.size() };	// it's a square matrix
+		const auto kColsRows { vve.rows() };	// it's a square matrix
 		if( kColsRows == 0 )
 			return std::unexpected( DistErr::kZeroLen );
 
-		Matrix distances( kColsRows, DVec( kColsRows, DVec::value_type {} ) );
+		Matrix distances( kColsRows, kColsRows );
 
-		for( auto r { DVec::size_type {} }; r < kColsRows; ++ r )
-		{
-			const auto & v = ( vve )[ r ];
-			for( auto c { r + 1 }; c < kColsRows; ++ c )
-				distances[ r ][ c ] = std::inner_product( v.begin(), v.end(), ( vve )[ c ].begin(), std::remove_cvref_t< decltype(v) >::value_type {} );
-		}
+		gram_upper( vve, distances, SimilarityPool() );		// distances( r, c ) = vve.row( r ) . vve.row( c ) for c > r - blocked, with SIMD, by all cores
 
 		return distances;
 	}
@@ -258,51 +236,68 @@ namespace Monadic_VectorsPipeTest
 
 	max_exp find_max( Matrix && de )
 	{
-		const auto kColsRows { de.size() };	// it's a square matrix
+		const auto kColsRows { de.rows() };	// it's a square matrix
 		assert( kColsRows > 0 );
-		assert( (de)[ 0 ].size() > 0 );
+		assert( de.cols() == kColsRows );
 
 		constexpr DType kNoneVal { std::numeric_limits< DType >::lowest() };
-		index_val ret { 0u, 0u, kNoneVal };
-		for( Matrix::size_type r {}; r < kColsRows; ++ r )
-		{
-			for( Matrix::size_type c { r + 1 }; c < kColsRows; ++ c )
-			{
-				auto val = (de)[ r ][ c ];
-				assert( val >= -1.1 && val <= +1.1 );
 
-				if( std::get< 2 >( ret ) < val )
-					ret = { r, c, val };
-			}
-		}
+		// By all cores - the first maximum in the row by row order, whatever the number of threads
+		const auto theMax = argmax_upper( de, SimilarityPool() );
+		assert( theMax.fVal == kNoneVal || ( theMax.fVal >= -1.1 && theMax.fVal <= +1.1 ) );
+
+		index_val ret { theMax.fRow, theMax.fCol, theMax.fVal };
 
 		return std::get< 2 >( ret ) != kNoneVal ? max_exp { ret } : std::unexpected( DistErr::kWrongData );
 	}
 
 	max_com_exp find_max_common( Matrix && de )
 	{
-		const auto kColsRows { de.size() };	// it's a square matrix
+		const auto kColsRows { de.rows() };	// it's a square matrix
 		assert( kColsRows > 0 );
-		assert( (de)[ 0 ].size() > 0 );
+		assert( de.cols() == kColsRows );
 
 		constexpr DType kNoneVal { std::numeric_limits< DType >::lowest() };
-		index_val ret { 0u, 0u, kNoneVal };
-		for( Matrix::size_type r {}; r < kColsRows; ++ r )
-		{
-			for( Matrix::size_type c { r + 1 }; c < kColsRows; ++ c )
-			{
-				auto val = (de)[ r ][ c ];
-				assert( val >= -1.1 && val <= +1.1 );
 
-				if( std::get< 2 >( ret ) < val )
-					ret = { r, c, val };
-			}
-		}
+		// By all cores - the first maximum in the row by row order, whatever the number of threads
+		const auto theMax = argmax_upper( de, SimilarityPool() );
+		assert( theMax.fVal == kNoneVal || ( theMax.fVal >= -1.1 && theMax.fVal <= +1.1 ) );
+
+		index_val ret { theMax.fRow, theMax.fCol, theMax.fVal };
 
 		return std::get< 2 >( ret ) != kNoneVal ? max_exp { ret } : std::unexpected( DistErr::kWrongData );
 	}
 
 
+	// The fused comp_distance_common + find_max_common - the similarities are computed tile by tile and only
+	// the maximum is kept, so there is no N x N matrix (the memory is O( N D ) rather than O( N^2 ))
+	max_com_exp find_max_fused_common( Matrix && vve )
+	{
+		if( vve.rows() == 0 )
+			return std::unexpected( DistErr::kZeroLen );
+
+		constexpr DType kNoneVal { std::numeric_limits< DType >::lowest() };
+
+		const auto theMax = max_pair( vve, SimilarityPool() );
+
+		return theMax.fVal != kNoneVal ? max_com_exp { index_val { theMax.fRow, theMax.fCol, theMax.fVal } } : std::unexpected( DistErr::kWrongData );
+	}
+
+
+	// Makes the stage, which finds the k_pairs most similar pairs and the k_nn nearest neighbours of each vector,
+	// all in one pass (see nearest()) - sorted, so these for any smaller k are at their beginnings
+	auto find_nearest_common( std::size_t k_pairs, std::size_t k_nn )
+	{
+		return [ = ]( Matrix && vve ) -> nearest_com_exp
+		{
+			if( vve.rows() < 2 )
+				return std::unexpected( vve.rows() == 0 ? DistErr::kZeroLen : DistErr::kWrongData );		// no pairs
+
+			return nearest( vve, k_pairs, k_nn, SimilarityPool() );
+		};
+	}
+
+
 	// https://en.cppreference.com/w/cpp/utility/variant/visit
 	// helper type for the visitor
 	template<class... Ts>
@@ -317,8 +312,7 @@ namespace Monadic_VectorsPipeTest
 							.and_then( [ ext = kFileExt ] ( auto && pe ) { return load_paths_common( std::move( pe ), ext ); } )
 							.and_then( load_vectors_common )
 							.and_then( vec_normalize_common )
-							.and_then( comp_distance_common )		
-							.and_then( find_max_common )
+							.and_then( find_max_fused_common )		// the same as comp_distance_common and then find_max_common (checked below)
 
 							.and_then( [] ( auto && r )
 									{
@@ -349,6 +343,33 @@ namespace Monadic_VectorsPipeTest
 		std::println( "typeid( result ).name() == {}", typeid( result ).name() );
 
 
+		// The 5 most similar pairs and the 3 nearest neighbours of each vector
+		auto nearest_result =	path_com_exp( ".\\..\\data"sv )	
+									.and_then( [ ext = kFileExt ] ( auto && pe ) { return load_paths_common( std::move( pe ), ext ); } )
+									.and_then( load_vectors_common )
+									.and_then( vec_normalize_common )
+									.and_then( find_nearest_common( 5, 3 ) );
+
+		if( nearest_result && not nearest_result->fTopPairs.empty() )
+		{
+			auto [ x, y, v ] = nearest_result->fTopPairs.front();
+			std::println( "nearest pair @ idx=({},{}; val={:.3f}), {} neighbours of each vector", x, y, v, nearest_result->fK );
+		}
+
+
+		// find_max_fused_common gives the same as the unfused comp_distance_common and find_max_common,
+		// which make the N x N matrix of the similarities in between - checked on the same vectors
+		const auto the_vectors =	path_com_exp( ".\\..\\data"sv )
+											.and_then( [ ext = kFileExt ] ( auto && pe ) { return load_paths_common( std::move( pe ), ext ); } )
+											.and_then( load_vectors_common )
+											.and_then( vec_normalize_common );
+
+		const auto fused_result		= vec_vec_com_exp( the_vectors ).and_then( find_max_fused_common );
+		const auto unfused_result	= vec_vec_com_exp( the_vectors ).and_then( comp_distance_common ).and_then( find_max_common );
+
+		std::println( "the fused and the unfused stages give the same: {}", fused_result == unfused_result );
+
+
 
 		std::vector vals { 10, 11, 2, -3, 4, 55, 0, 0, -4, 10, -8 };
 
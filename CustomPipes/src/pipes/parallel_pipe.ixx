@@ -0,0 +1,1025 @@
+// ---------------------------------------------------
+// Created by Boguslaw Cyganek (C) 2024
+// ---------------------------------------------------
+
+
+export module parallel_pipe;
+
+
+
+
+import <cstddef>;
+import <cassert>;
+import <string>;
+import <string_view>;
+import <vector>;
+import <span>;
+import <format>;
+import <ranges>;
+import <iterator>;
+import <expected>;
+import <utility>;
+import <concepts>;
+import <type_traits>;
+import <functional>;
+import <memory>;
+import <mutex>;
+import <condition_variable>;
+import <atomic>;
+import <thread>;
+import <stop_token>;
+import <future>;
+import <chrono>;
+
+import payload;
+import synchro_queue;
+import thread_pool;
+import async_queue;
+import pipe_stage;
+import batch_stage;
+import pipe_stats;
+
+
+
+// -----------------------------------------------------------
+// The parallel pipe - each stage runs in its own thread (or on the pool), and the stages are joined by the queues.
+// Examples:
+//
+//		auto thePipe = theFirstQueue | add_2 | add_3 | split() | add_2 | sink( print );
+//
+// The adjacent stages are fused into one thread - a new one starts at split() (see custom_pipe_parallel.cpp for more).
+//
+
+
+
+
+// The stage function takes the element by rvalue and gives it back - it should change it in place
+// and move it out (not copy), so the buffer of its string is allocated once for the whole pipe
+export using PaylodOrErrorProcFun = std::function< PayloadOrError ( PayloadOrError && in_elem ) >;
+
+
+
+
+
+export using NB_PayloadOrError_Queue = TSynchroQueue< PayloadOrError >;
+
+export using NB_PayloadOrError_Queue_SS = std::shared_ptr< NB_PayloadOrError_Queue >;
+
+
+// The lock-free alternative - each queue of the parallel pipe has exactly one producer and one consumer
+export using NB_PayloadOrError_SpscQueue = TSpscRingQueue< PayloadOrError >;
+
+export using NB_PayloadOrError_SpscQueue_SS = std::shared_ptr< NB_PayloadOrError_SpscQueue >;
+
+
+// Any queue with the push/pop/size surface of TSynchroQueue can join the stages.
+// The queue type is chosen at compile time by the type of the first queue in the pipe.
+export template < typename Q >
+concept NB_Queue_Type = requires( Q q, typename Q::value_type e ) 
+								{
+									q.push( std::move( e ) );
+									{ q.pop() } -> std::same_as< typename Q::ExpectedElem >;
+									q.size();
+									q.capacity();
+									q.push_bulk( std::span< typename Q::value_type > {} );
+									{ q.pop_bulk( std::declval< std::vector< typename Q::value_type > & >(), std::size_t {} ) } -> std::same_as< std::size_t >;
+									q.close();
+									q.cancel();
+									{ q.is_cancelled() } -> std::same_as< bool >;
+								};
+
+export template < typename Q >
+concept NB_PayloadOrError_Queue_Type = NB_Queue_Type< Q > && std::same_as< typename Q::value_type, PayloadOrError >;
+
+
+// The queue of the same kind as Queue, but of the OutElem objects - for the stages which change the type (see the typed pipe)
+export template < typename Queue, typename OutElem >
+struct NB_Rebind_Queue;
+
+template < typename Elem, typename OutElem >
+struct NB_Rebind_Queue< TSynchroQueue< Elem >, OutElem > { using type = TSynchroQueue< OutElem >; };
+
+template < typename Elem, std::size_t kCapacity, typename OutElem >
+struct NB_Rebind_Queue< TSpscRingQueue< Elem, kCapacity >, OutElem > { using type = TSpscRingQueue< OutElem, kCapacity >; };
+
+export template < typename Queue, typename OutElem >
+using NB_Rebind_Queue_t = typename NB_Rebind_Queue< Queue, OutElem >::type;
+
+
+
+
+export template< typename Elem >
+using NB_ParallelPipeFun = std::function< void ( TSynchroQueue< Elem > & in_q, TSynchroQueue< Elem > & out_q ) >;
+
+export using NB_ParallelPipeFun_4_PayloadOrError = NB_ParallelPipeFun< PayloadOrError >;
+
+
+// The max number of elements taken from the queue at once
+constexpr	std::size_t	kBatchSize			{ 64 };
+
+
+
+// The completion of a running pipe - counts its threads that still run.
+// When two pipes are joined with |, the state of the head is merged into the one of the tail,
+// so the threads of the head, which still hold the old state, count for the whole pipe.
+export class NB_PipeDone
+{
+public:
+
+	using Callback = std::move_only_function< void () >;
+
+	void ThreadStarted()
+	{
+		std::unique_lock	theLock( fMutex );
+		++ fRunning;
+	}
+
+	void ThreadDone()
+	{
+		std::unique_lock	theLock( fMutex );
+
+		// The last one calls the callbacks (also those added in the meantime) before the waiters are released
+		while( fRunning == 1 && not fMergedInto && not fCallbacks.empty() )
+		{
+			auto callbacks = std::move( fCallbacks );
+			fCallbacks.clear();
+			theLock.unlock();
+
+			for( auto & c : callbacks )
+				c();
+
+			theLock.lock();
+		}
+
+		if( fMergedInto )
+		{
+			auto tail = fMergedInto;
+			theLock.unlock();
+			tail->ThreadDone();
+			return;
+		}
+
+		assert( fRunning > 0 );
+		if( -- fRunning == 0 )
+		{
+			theLock.unlock();
+			fCondVar.notify_all();
+		}
+	}
+
+	void MergeInto( std::shared_ptr< NB_PipeDone > tail )
+	{
+		std::scoped_lock	theLock( fMutex, tail->fMutex );
+		tail->fRunning += std::exchange( fRunning, 0 );
+		std::ranges::move( fCallbacks, std::back_inserter( tail->fCallbacks ) );
+		fCallbacks.clear();
+		fMergedInto = std::move( tail );
+	}
+
+	void Wait()
+	{
+		std::unique_lock	theLock( fMutex );
+		fCondVar.wait( theLock, [ this ]() { return fRunning == 0; } );
+	}
+
+	template < typename Rep, typename Period >
+	bool WaitFor( const std::chrono::duration< Rep, Period > & timeout )
+	{
+		std::unique_lock	theLock( fMutex );
+		return fCondVar.wait_for( theLock, timeout, [ this ]() { return fRunning == 0; } );
+	}
+
+	// If already done, then the callback is called at once, in the calling thread
+	void OnDone( Callback && c )
+	{
+		std::unique_lock	theLock( fMutex );
+
+		if( fRunning > 0 )
+		{
+			fCallbacks.push_back( std::move( c ) );
+			return;
+		}
+
+		theLock.unlock();
+		c();
+	}
+
+private:
+
+	std::mutex								fMutex;
+
+	std::condition_variable				fCondVar;
+
+	std::size_t								fRunning {};
+
+	std::vector< Callback >				fCallbacks;
+
+	std::shared_ptr< NB_PipeDone >		fMergedInto;
+};
+
+
+
+// The running pipe - this is what operator | returns. It owns the threads of all its stages,
+// so none of them is detached, and -> gives access to its last queue, e.g. out_q_SS->pop().
+// There are two ways to finish:
+//		- drain:	close() the first queue - the stages process what is left, close their out queues
+//					one after another, and finish; the consumer gets EQueueErr::kClosed after the last element;
+//		- abort:	cancel(), or just let the pipe object go - the stop is requested on all threads
+//					(std::jthread's stop_token), their queues are cancelled, and the threads are joined.
+// The end can be awaited with wait() or wait_for(), with the future, or with a callback (on_done).
+// A pipe that ends with sink() is done when the sink has consumed all results.
+// The stages with no threads of their own (pooled) are not counted.
+export template < typename Queue >
+class NB_Pipeline
+{
+public:
+
+	using queue_type = Queue;
+
+	explicit NB_Pipeline( std::shared_ptr< Queue > out_q ) : fOutQueue( std::move( out_q ) ) {}
+
+	NB_Pipeline( NB_Pipeline && ) = default;
+	NB_Pipeline & operator = ( NB_Pipeline && ) = default;
+
+	~NB_Pipeline() { cancel(); }		// then the jthreads join
+
+public:
+
+	Queue * operator -> () const { return fOutQueue.get(); }
+
+	const std::shared_ptr< Queue > & out_queue() const { return fOutQueue; }
+
+	// Abort - does not wait for the threads to finish, wait() or join() do
+	void cancel()
+	{
+		for( auto & t : fThreads )
+			t.request_stop();
+	}
+
+	// Blocks until all stage threads finish - after the first queue was closed, this means that all data went through
+	// (if the queues are bounded, then someone must pop from the out queue in the meantime - e.g. the sink)
+	void wait() const { fDone->Wait(); }
+
+	// The same but no longer than timeout - returns false if the pipe still runs
+	template < typename Rep, typename Period >
+	bool wait_for( const std::chrono::duration< Rep, Period > & timeout ) const { return fDone->WaitFor( timeout ); }
+
+	// The callback is called by the thread which finishes last (or at once, if the pipe is already done)
+	void on_done( NB_PipeDone::Callback && c ) { fDone->OnDone( std::move( c ) ); }
+
+	std::future< void > get_future()
+	{
+		auto		thePromise( std::make_shared< std::promise< void > >() );
+		auto		theFuture( thePromise->get_future() );
+		on_done( [ thePromise ]() { thePromise->set_value(); } );
+		return theFuture;
+	}
+
+	// As wait(), but the threads are also joined
+	void join()
+	{
+		for( auto & t : fThreads )
+			if( t.joinable() )
+				t.join();
+	}
+
+	// Runs f( stop_token, args ... ) as a new thread of the pipe
+	template < typename Fun, typename ... Args >
+	void start_thread( Fun && f, Args && ... args )
+	{
+		fDone->ThreadStarted();
+
+		fThreads.emplace_back( [ done = fDone, f = std::forward< Fun >( f ), ... args = std::forward< Args >( args ) ]( std::stop_token st ) mutable
+		{
+			std::invoke( f, std::move( st ), std::move( args ) ... );
+			done->ThreadDone();
+		} );
+	}
+
+	// Takes over the threads of the head of the pipe, i.e. of its stages placed before ours
+	template < typename HeadQueue >
+	void add_threads( NB_Pipeline< HeadQueue > && head )
+	{
+		std::ranges::move( head.fThreads, std::back_inserter( fThreads ) );
+		head.fThreads.clear();
+		head.fDone->MergeInto( fDone );
+	}
+
+private:
+
+	template < typename >
+	friend class NB_Pipeline;
+
+	std::shared_ptr< Queue >				fOutQueue;
+
+	std::shared_ptr< NB_PipeDone >		fDone { std::make_shared< NB_PipeDone >() };
+
+	std::vector< std::jthread >			fThreads;
+};
+
+
+// Joins a running pipe with the next stage, e.g. ( in_q | add_2 | split() ) | add_3 - this is any stage
+// that can be joined to the last queue of the pipe. The new pipe owns the threads of both.
+export template < typename Queue, typename Stage >
+requires requires( std::shared_ptr< Queue > q, Stage && s ) { q | std::forward< Stage >( s ); }
+auto operator | ( NB_Pipeline< Queue > && head, Stage && s )
+{
+	auto tail = head.out_queue() | std::forward< Stage >( s );
+
+	if constexpr( requires { tail.add_threads( std::move( head ) ); } )
+	{
+		tail.add_threads( std::move( head ) );
+		return tail;
+	}
+	else
+	{
+		// The stage with no thread of its own (e.g. pooled) - returns just the out queue
+		NB_Pipeline< typename decltype( tail )::element_type >		thePipe( std::move( tail ) );
+		thePipe.add_threads( std::move( head ) );
+		return thePipe;
+	}
+}
+
+
+
+// If the stats are on for the pipe (see TSynchroQueue::set_stats), then registers the new stage
+// and lets its in queue record the depth. Otherwise returns nullptr - then the stage measures nothing.
+template < typename Queue >
+TStageStats *	NB_Register_Stage( Queue & in_q, std::string_view kind )
+{
+	if constexpr( requires { in_q.stats(); } )
+		if( const auto & stats = in_q.stats() )
+		{
+			auto & theStage = stats->add_stage( kind );
+			in_q.set_depth_stats( & theStage.in_queue_stats() );
+			return & theStage;
+		}
+
+	return nullptr;
+}
+
+
+// pop_bulk with the time of waiting recorded - if the stats are on
+template < typename Queue, typename Elem >
+std::size_t		NB_Pop_Bulk( Queue & in_q, std::vector< Elem > & in_batch, std::size_t max_batch, TStageStats * stats )
+{
+	if( not stats )
+		return in_q.pop_bulk( in_batch, max_batch );
+
+	const auto t0 = StatsClock::now();
+	const auto n = in_q.pop_bulk( in_batch, max_batch );
+	stats->RecordPop( StatsClock::now() - t0, n );
+	return n;
+}
+
+
+// Measures the time of the stage function for one object, from its construction to destruction
+class NB_StageTimer
+{
+public:
+
+	explicit NB_StageTimer( TStageStats * stats ) : fStats( stats ), fStart( stats ? StatsClock::now() : StatsClock::time_point {} ) {}
+
+	~NB_StageTimer()
+	{
+		if( fStats )
+			fStats->RecordItem( StatsClock::now() - fStart );
+	}
+
+	NB_StageTimer & operator = ( NB_StageTimer && ) = delete;
+
+private:
+
+	TStageStats *					fStats;
+	StatsClock::time_point		fStart;
+};
+
+
+
+// Runs in a separate thread. Takes from in_q whatever is available (up to max_batch elements),
+// processes the whole batch with theCartridgeFun, and pushes the results to out_q at once.
+// This way the queues are locked and notified once per batch rather than once per element.
+// The loop ends when in_q is closed and drained (then out_q is closed) or cancelled
+// (then out_q is cancelled, so the abort also goes down the pipe). A stop request on the thread
+// cancels both queues, which wakes up the thread no matter where it waits.
+// If the stage is replicated, then all replicas share in_q and out_q, and running_replicas
+// counts those still running - only the last one closes out_q.
+// Function is PaylodOrErrorProcFun, or any other callable kept with its own type.
+// If it is TBatchStage, then it gets the whole batch at once in the SoA form.
+// stats is nullptr if the instrumentation is off.
+template < NB_PayloadOrError_Queue_Type Queue, typename Function = PaylodOrErrorProcFun >
+void		NB_ParPipe_Fun_Loop(	std::stop_token st, std::shared_ptr< Queue > in_q, std::shared_ptr< Queue > out_q, Function theCartridgeFun, 
+										std::size_t max_batch, std::shared_ptr< std::atomic< std::size_t > > running_replicas, TStageStats * stats )
+{
+	std::stop_callback	onStop( st, [ & ]() { in_q->cancel(); out_q->cancel(); } );
+
+	std::vector< PayloadOrError >	in_batch, out_batch;
+	in_batch.reserve( max_batch );
+	out_batch.reserve( max_batch );
+
+	TPayloadBatch		soa_batch;		// only for the batch kernels
+
+	while( NB_Pop_Bulk( * in_q, in_batch, max_batch, stats ) > 0 )		// blocks until there is at least one element
+	{
+		if constexpr( is_batch_stage_v< Function > )
+		{
+			soa_batch.assign( in_batch );
+			{
+				NB_StageTimer	theTimer( stats );		// here the time is per batch
+				std::invoke( theCartridgeFun, soa_batch );
+			}
+			soa_batch.move_to( out_batch );
+		}
+		else
+		{
+			for( auto & elem : in_batch )
+			{
+				NB_StageTimer	theTimer( stats );
+				out_batch.push_back( theCartridgeFun( std::move( elem ) ) );		// do some action with the pop'ed element
+			}
+		}
+
+		if( stats )
+			stats->RecordPush( out_batch.size() );
+
+		out_q->push_bulk( out_batch );
+
+		in_batch.clear();
+		out_batch.clear();
+	}
+
+	// All our results are already in out_q, so we can pass the end of the data
+	if( in_q->is_cancelled() )
+		out_q->cancel();
+	else if( not running_replicas || running_replicas->fetch_sub( 1 ) == 1 )
+		out_q->close();			// we are the only or the last one
+}
+
+
+
+// Creates the out queue of a stage - it is of the same kind and capacity as the in queue,
+// so the backpressure set at the first queue propagates through the whole pipe.
+// OutQueue is other than Queue only if the stage changes the type of the objects.
+export template < NB_Queue_Type Queue, NB_Queue_Type OutQueue = Queue >
+auto NB_Make_Out_Queue( const Queue & in_q ) -> std::shared_ptr< OutQueue >
+{
+	std::shared_ptr< OutQueue >	out_q;
+
+	if constexpr( std::constructible_from< OutQueue, std::size_t > )
+		out_q = std::make_shared< OutQueue >( in_q.capacity() );
+	else
+		out_q = std::make_shared< OutQueue >();		// the capacity is a template parameter
+
+	if constexpr( requires { out_q->set_stats( in_q.stats() ); } )
+		out_q->set_stats( in_q.stats() );			// the same goes for the instrumentation
+
+	return out_q;
+}
+
+
+// The stage given explicitly as std::function, e.g. in_q | PaylodOrErrorProcFun( add_2 ) - the type-erased stage
+// is always run by its own thread (the stages kept with their own types are fused, see below).
+// The out queue is of the same type as the in queue.
+export template < NB_PayloadOrError_Queue_Type Queue >
+auto operator | ( std::shared_ptr< Queue > in_queue, PaylodOrErrorProcFun && f ) -> NB_Pipeline< Queue >
+{
+	NB_Pipeline< Queue >		thePipe( NB_Make_Out_Queue( * in_queue ) );
+
+	thePipe.start_thread( NB_ParPipe_Fun_Loop< Queue >, in_queue, thePipe.out_queue(), std::move( f ), kBatchSize, nullptr, NB_Register_Stage( * in_queue, "fun" ) );
+
+	return thePipe;
+}
+
+
+
+// The sink - the last stage of the pipe, which consumes the results as soon as they come, e.g.
+//		auto thePipe = in_q | add_2 | add_3 | sink( []( PayloadOrError && e ) { ... } );
+//		thePipe.wait();
+// It takes the objects of any type, so it can also end the typed pipes (see below).
+export template < typename Function >
+struct NB_SinkStage
+{
+	Function		fFun;
+};
+
+export template < typename Function >
+auto sink( Function && f ) -> NB_SinkStage< std::decay_t< Function > >
+{
+	return { std::forward< Function >( f ) };
+}
+
+
+// Runs in a separate thread until in_q is closed and drained, or cancelled
+template < typename Queue, typename Function >
+void		NB_Sink_Fun_Loop( std::stop_token st, std::shared_ptr< Queue > in_q, Function theSinkFun, TStageStats * stats )
+{
+	std::stop_callback	onStop( st, [ & ]() { in_q->cancel(); } );
+
+	std::vector< typename Queue::value_type >	in_batch;
+	in_batch.reserve( kBatchSize );
+
+	while( NB_Pop_Bulk( * in_q, in_batch, kBatchSize, stats ) > 0 )
+	{
+		for( auto & elem : in_batch )
+		{
+			NB_StageTimer	theTimer( stats );
+			std::invoke( theSinkFun, std::move( elem ) );
+		}
+
+		in_batch.clear();
+	}
+}
+
+
+// There is no out queue - the pipe gives in_queue as its out_queue(), but there is nothing to pop from it
+export template < typename Queue, typename Function >
+requires std::invocable< Function &, typename Queue::value_type && >
+auto operator | ( std::shared_ptr< Queue > in_queue, NB_SinkStage< Function > && s ) -> NB_Pipeline< Queue >
+{
+	NB_Pipeline< Queue >		thePipe( in_queue );
+
+	thePipe.start_thread( NB_Sink_Fun_Loop< Queue, Function >, in_queue, std::move( s.fFun ), NB_Register_Stage( * in_queue, "sink" ) );
+
+	return thePipe;
+}
+
+
+
+// ===================================================================
+// The stages kept with their own types - the functions, fn< f >, the lambdas, and the fused stages (see the pipe_stage module).
+// The stages joined one after another are fused - all of them are run by one thread, and the calls can be inlined
+// into one loop body, with no std::function in between. A new thread is started only at split(), e.g.
+//
+//		auto out_q = ( in_q | add_2 | add_3 | add_2 ).run();						// one thread
+//		auto out_q = ( in_q | add_2 | add_3 | split() | add_2 ).run();		// two threads
+//
+// Also the stages with their own threads (e.g. sink(), parallel()) start after the fused ones.
+// In the same way the batch stages joined one after another are run as one batch() - by one thread, on the batch
+// converted to the SoA form once for all of them (see TBatchStage).
+// As in the serial pipe, each stage can take and return a different std::expected - then the queue after the chain
+// is of the type of its result, and of the same kind as the first queue (e.g. all are SPSC, or all bounded TSynchroQueue).
+// The end of the data and the abort go in the same way as in the pipe of PayloadOrError.
+
+
+// The std::function is the type-erased stage - it is never fused
+export template < typename F >
+inline constexpr bool NB_Is_Type_Erased = false;
+
+template < typename Signature >
+inline constexpr bool NB_Is_Type_Erased< std::function< Signature > > = true;
+
+// The stage that can be fused - it takes the In object and gives some std::expected
+export template < typename F, typename In >
+concept NB_Fusable_Stage =	( not NB_Is_Type_Erased< std::decay_t< F > > )
+									&& std::invocable< const std::decay_t< F > &, In && >
+									&& is_expected< std::invoke_result_t< const std::decay_t< F > &, In && > >;
+
+
+// The thread boundary - see operator | of NB_FusedPipe
+export struct NB_SplitStage {};
+
+export inline auto split() -> NB_SplitStage
+{
+	return {};
+}
+
+
+// The type of the objects given by the chain - the batch stages change them in place
+template < typename Chain, typename In >
+struct NB_Chain_Result { using type = std::invoke_result_t< const Chain &, In && >; };
+
+template < typename ... Kernels, typename In >
+struct NB_Chain_Result< TBatchStage< Kernels ... >, In > { using type = In; };
+
+
+// Runs the fused chain in a separate thread - the chain is kept with its own type
+template < NB_Queue_Type InQueue, NB_Queue_Type OutQueue, typename Chain >
+void		NB_FusedPipe_Fun_Loop( std::stop_token st, std::shared_ptr< InQueue > in_q, std::shared_ptr< OutQueue > out_q, Chain theChain, TStageStats * stats )
+{
+	std::stop_callback	onStop( st, [ & ]() { in_q->cancel(); out_q->cancel(); } );
+
+	std::vector< typename InQueue::value_type >		in_batch;
+	std::vector< typename OutQueue::value_type >	out_batch;
+	in_batch.reserve( kBatchSize );
+	out_batch.reserve( kBatchSize );
+
+	while( NB_Pop_Bulk( * in_q, in_batch, kBatchSize, stats ) > 0 )		// 0 means that in_q is closed and drained, or cancelled
+	{
+		for( auto & elem : in_batch )
+		{
+			NB_StageTimer	theTimer( stats );
+			out_batch.push_back( theChain( std::move( elem ) ) );		// all stages of the chain, one after another
+		}
+
+		if( stats )
+			stats->RecordPush( out_batch.size() );
+
+		out_q->push_bulk( out_batch );
+
+		in_batch.clear();
+		out_batch.clear();
+	}
+
+	// Pass the end of the data (or the abort) further on
+	if( in_q->is_cancelled() )
+		out_q->cancel();
+	else
+		out_q->close();
+}
+
+
+// The stages joined to the queue, which are not run yet. Each next stage kept with its own type is appended
+// to the chain, and the thread of the chain is started when the chain ends - by split(), by a stage with its own
+// threads (e.g. parallel() or sink()), or by run(). Each chain must end with one of them, e.g.
+//
+//		auto p = ( in_q | add_2 | add_3 ).run();		// now p is NB_Pipeline, as in_q | add_2 | add_3 | split()
+//
+// The chain which was never started asserts in its destructor - otherwise it would process nothing
+// (and e.g. a push above the capacity of a bounded in_q would block for good).
+export template < NB_Queue_Type Queue, typename Chain >
+class [[nodiscard]] NB_FusedPipe
+{
+public:
+
+	using out_elem_type	= typename NB_Chain_Result< Chain, typename Queue::value_type >::type;
+
+	using queue_type		= NB_Rebind_Queue_t< Queue, out_elem_type >;
+
+	// The stage that can be appended to the chain - a batch stage to the batch stages, and the other ones to the other ones
+	template < typename Stage >
+	static constexpr bool kAppendable = is_batch_stage_v< Chain >	? is_batch_stage_v< std::decay_t< Stage > >
+																						: NB_Fusable_Stage< Stage, out_elem_type >;
+
+	// head are the stages before the chain - its out queue is the in queue of the chain
+	NB_FusedPipe( NB_Pipeline< Queue > && head, Chain && chain ) : fHead( std::move( head ) ), fChain( std::move( chain ) ) {}
+
+	NB_FusedPipe( NB_FusedPipe && other ) : fHead( std::move( other.fHead ) ), fChain( std::move( other.fChain ) ), fDone( std::exchange( other.fDone, true ) ) {}
+
+	NB_FusedPipe & operator = ( NB_FusedPipe && ) = delete;
+
+	~NB_FusedPipe() { assert( fDone && "the chain was never started - end it with split() or run()" ); }
+
+public:
+
+	// Starts the thread of the chain - the running pipe takes over all threads (the chain is left empty)
+	[[nodiscard]] NB_Pipeline< queue_type > run() &&
+	{
+		assert( not fDone );
+		fDone = true;
+
+		const auto	in_queue { fHead.out_queue() };
+
+		NB_Pipeline< queue_type >	thePipe( NB_Make_Out_Queue< Queue, queue_type >( * in_queue ) );
+
+		if constexpr( is_batch_stage_v< Chain > )
+			thePipe.start_thread( NB_ParPipe_Fun_Loop< Queue, Chain >, in_queue, thePipe.out_queue(), std::move( fChain ), kBatchSize, nullptr, NB_Register_Stage( * in_queue, "batch" ) );
+		else
+			thePipe.start_thread(	NB_FusedPipe_Fun_Loop< Queue, queue_type, Chain >, in_queue, thePipe.out_queue(), std::move( fChain ), 
+											NB_Register_Stage( * in_queue, Chain::size() > 1 ? std::format( "fused( {} )", Chain::size() ) : std::string( "fun" ) ) );
+
+		thePipe.add_threads( std::move( fHead ) );
+		return thePipe;
+	}
+
+	// Takes over the threads of the stages placed before ours (see operator | of NB_Pipeline)
+	template < typename HeadQueue >
+	void add_threads( NB_Pipeline< HeadQueue > && head )
+	{
+		assert( not fDone );
+		fHead.add_threads( std::move( head ) );
+	}
+
+public:
+
+	// One more stage in the same thread - it must take what the chain gives
+	template < typename Fun >
+	requires kAppendable< Fun >
+	friend auto operator | ( NB_FusedPipe && p, Fun && f )
+	{
+		assert( not p.fDone );
+		p.fDone = true;		// passed on to the longer chain
+		auto theChain = std::move( p.fChain ) | std::forward< Fun >( f );
+		return NB_FusedPipe< Queue, decltype( theChain ) >( std::move( p.fHead ), std::move( theChain ) );
+	}
+
+	// The thread boundary - the next stage will be run by a new thread
+	friend auto operator | ( NB_FusedPipe && p, NB_SplitStage ) -> NB_Pipeline< queue_type >
+	{
+		return std::move( p ).run();
+	}
+
+	// Any other stage - it has its own threads, so the chain is started first
+	template < typename Stage >
+	requires ( not kAppendable< Stage > ) && ( not std::same_as< std::decay_t< Stage >, NB_SplitStage > )
+				&& requires( NB_Pipeline< queue_type > && p, Stage && s ) { std::move( p ) | std::forward< Stage >( s ); }
+	friend auto operator | ( NB_FusedPipe && p, Stage && s )
+	{
+		return std::move( p ).run() | std::forward< Stage >( s );
+	}
+
+private:
+
+	NB_Pipeline< Queue >		fHead;
+
+	Chain							fChain;
+
+	bool							fDone {};		// started, or passed on to another object
+};
+
+
+// E.g. in_q | add_2, or path_q | load_paths | load_vectors | vec_normalize - this begins the chain, the next stages are appended to it
+export template < NB_Queue_Type Queue, typename Fun >
+requires NB_Fusable_Stage< Fun, typename Queue::value_type >
+auto operator | ( std::shared_ptr< Queue > in_queue, Fun && f )
+{
+	auto theChain = fuse( std::forward< Fun >( f ) );
+	return NB_FusedPipe< Queue, decltype( theChain ) >( NB_Pipeline< Queue >( std::move( in_queue ) ), std::move( theChain ) );
+}
+
+
+// The batch stages (see batch() in the batch_stage module) - each batch popped from in_queue goes through all the kernels
+// at once, in the SoA form. The batch stages joined next are appended to this one, e.g. in_q | batch( add_2_batch ) | batch( add_3_batch ).
+export template < NB_PayloadOrError_Queue_Type Queue, typename ... Kernels >
+auto operator | ( std::shared_ptr< Queue > in_queue, TBatchStage< Kernels ... > && f ) -> NB_FusedPipe< Queue, TBatchStage< Kernels ... > >
+{
+	return { NB_Pipeline< Queue >( std::move( in_queue ) ), std::move( f ) };
+}
+// ===================================================================
+
+
+
+// A stage that runs in many threads at once - see parallel() and operator | below
+export struct NB_ParallelStage
+{
+	std::size_t					fReplicas {};
+	PaylodOrErrorProcFun		fFun;
+	bool							fKeepOrder {};
+};
+
+// Makes a stage that will be run by the given number of threads, e.g.
+//		auto out_q = ( in_q | add_2 | parallel( 4, some_heavy_fun ) | add_3 ).run();
+// This is a remedy for a stage that is much slower than the others.
+// However, the order of the objects leaving such a stage can be different than on its input.
+export inline auto parallel( std::size_t replicas, PaylodOrErrorProcFun && f ) -> NB_ParallelStage
+{
+	assert( replicas > 0 );
+	return NB_ParallelStage { replicas, std::move( f ) };
+}
+
+
+// The same as parallel(), but the objects leave the stage in the same order as they came in.
+// This costs some waiting - a fast replica cannot go further than kReorderWindowPerReplica * replicas
+// objects ahead of the slowest one.
+export inline auto ordered_parallel( std::size_t replicas, PaylodOrErrorProcFun && f ) -> NB_ParallelStage
+{
+	assert( replicas > 0 );
+	return NB_ParallelStage { replicas, std::move( f ), true };
+}
+
+
+constexpr	std::size_t	kReorderWindowPerReplica	{ 4 };
+
+using NB_PayloadOrError_ReorderBuffer = TReorderBuffer< PayloadOrError >;
+
+
+// The replica of the ordered stage. Each object gets its sequence number when leaving in_q,
+// and after processing it goes to the reorder buffer which passes it to out_q in the right order.
+// Since all objects are already in the reorder buffer when the last replica finishes,
+// closing out_q does not cut off any of them.
+inline void		NB_OrderedParPipe_Fun_Loop(	std::stop_token st, NB_PayloadOrError_Queue_SS in_q, std::shared_ptr< NB_PayloadOrError_ReorderBuffer > reorder_buf, NB_PayloadOrError_Queue_SS out_q, 
+												PaylodOrErrorProcFun && theCartridgeFun, std::shared_ptr< std::atomic< std::size_t > > running_replicas, TStageStats * stats )
+{
+	std::stop_callback	onStop( st, [ & ]() { in_q->cancel(); reorder_buf->cancel(); out_q->cancel(); } );
+
+	for( ;; )
+	{
+		const auto t0 = stats ? StatsClock::now() : StatsClock::time_point {};
+
+		auto pop_elem = in_q->pop_sequenced();
+		if( not pop_elem )
+			break;
+
+		if( stats )
+			stats->RecordPop( StatsClock::now() - t0, 1 );
+
+		auto & [ seq_no, elem ] = * pop_elem;
+
+		PayloadOrError		out_elem;
+		{
+			NB_StageTimer	theTimer( stats );
+			out_elem = theCartridgeFun( std::move( elem ) );
+		}
+
+		reorder_buf->push( seq_no, std::move( out_elem ), * out_q );
+
+		if( stats )
+			stats->RecordPush( 1 );
+	}
+
+	if( in_q->is_cancelled() )
+	{
+		reorder_buf->cancel();		// some replica can wait there for the object that will never come
+		out_q->cancel();
+	}
+	else if( running_replicas->fetch_sub( 1 ) == 1 )
+	{
+		out_q->close();
+	}
+}
+
+
+// The replicas share in_queue - thus it must accept many consumers, as TSynchroQueue does
+// (so this is not for the SPSC queues).
+export inline auto operator | ( NB_PayloadOrError_Queue_SS in_queue, NB_ParallelStage && s ) -> NB_Pipeline< NB_PayloadOrError_Queue >
+{
+	NB_Pipeline< NB_PayloadOrError_Queue >		thePipe( NB_Make_Out_Queue( * in_queue ) );
+	const auto &	out_queue_sp = thePipe.out_queue();
+
+	auto		running_replicas( std::make_shared< std::atomic< std::size_t > >( s.fReplicas ) );
+
+	auto		reorder_buf( s.fKeepOrder ? std::make_shared< NB_PayloadOrError_ReorderBuffer >( kReorderWindowPerReplica * s.fReplicas ) : nullptr );
+
+	// All replicas share the stats of the stage
+	auto		theStats( NB_Register_Stage( * in_queue, std::format( "{}( {} )", s.fKeepOrder ? "ordered_parallel" : "parallel", s.fReplicas ) ) );
+
+	for( std::size_t i {}; i < s.fReplicas; ++ i )
+	{
+		// Each replica takes only one object at a time, so the work is evenly spread
+		if( s.fKeepOrder )
+			thePipe.start_thread( NB_OrderedParPipe_Fun_Loop, in_queue, reorder_buf, out_queue_sp, PaylodOrErrorProcFun( s.fFun ), running_replicas, theStats );
+		else
+			thePipe.start_thread( NB_ParPipe_Fun_Loop< NB_PayloadOrError_Queue >, in_queue, out_queue_sp, PaylodOrErrorProcFun( s.fFun ), 1, running_replicas, theStats );
+	}
+
+	return thePipe;
+}
+
+
+// A stage run as a task in the shared thread pool - see pooled() and operator | below
+export struct NB_PooledStage
+{
+	TWorkStealingPool &		fPool;
+	PaylodOrErrorProcFun		fFun;
+};
+
+// Makes a stage that does not have its own thread, e.g.
+//		auto out_q = in_q | pooled( pool, add_2 ) | pooled( pool, add_3 );
+// Instead, it is run as a task in the pool whenever there is something in its in queue.
+// Thus the number of threads does not depend on the number of stages.
+export inline auto pooled( TWorkStealingPool & pool, PaylodOrErrorProcFun && f ) -> NB_PooledStage
+{
+	return NB_PooledStage { pool, std::move( f ) };
+}
+
+
+// The max number of batches processed at one go - then the task gives way to other stages
+constexpr	std::size_t	kMaxBatchesPerRun			{ 4 };
+
+
+// The pooled stage. It is scheduled as a task in the pool when something is pushed to its in queue
+// (if it is not already scheduled). The task takes whatever is there and finishes,
+// so an idle stage does not hold any thread.
+class NB_PooledStageTask : public std::enable_shared_from_this< NB_PooledStageTask >
+{
+public:
+
+	NB_PooledStageTask( TWorkStealingPool & pool, NB_PayloadOrError_Queue_SS in_q, NB_PayloadOrError_Queue_SS out_q, PaylodOrErrorProcFun && f )
+		: fPool( pool ), fInQueue( in_q ), fOutQueue( out_q ), fCartridgeFun( std::move( f ) )
+	{
+		fInBatch.reserve( kBatchSize );
+		fOutBatch.reserve( kBatchSize );
+	}
+
+	// Can be called from any thread
+	void Schedule()
+	{
+		if( not fScheduled.exchange( true ) )
+			fPool.submit( [ self = shared_from_this() ]() { self->Run(); } );
+	}
+
+private:
+
+	// Thanks to fScheduled this is never run by two threads at once
+	void Run()
+	{
+		auto in_q = fInQueue.lock();
+		if( not in_q )
+			return;
+
+		for( std::size_t i {}; i < kMaxBatchesPerRun; ++ i )
+		{
+			fInBatch.clear();
+			fOutBatch.clear();
+
+			if( in_q->try_pop_bulk( fInBatch, kBatchSize ) == 0 )
+				break;
+
+			for( auto & elem : fInBatch )
+				fOutBatch.push_back( fCartridgeFun( std::move( elem ) ) );
+
+			fOutQueue->push_bulk( fOutBatch );
+		}
+
+		// Nothing can be pushed after close(), so if it is closed and then empty, then it is drained for good
+		if( in_q->is_closed() && in_q->empty() )
+		{
+			if( in_q->is_cancelled() )
+				fOutQueue->cancel();
+			else
+				fOutQueue->close();		// pass the end of the data further on
+			return;		// fScheduled stays true - the stage will not be run anymore
+		}
+
+		fScheduled.store( false );
+
+		// Something could have been pushed (or the queue closed) after the last try_pop_bulk but before
+		// clearing fScheduled - then Schedule() called by the producer did nothing, so we need to do it here
+		if( not in_q->empty() || in_q->is_closed() )
+			Schedule();
+	}
+
+private:
+
+	TWorkStealingPool &							fPool;
+
+	std::weak_ptr< NB_PayloadOrError_Queue >	fInQueue;		// in_q holds us, so here it is weak to avoid a cycle
+
+	NB_PayloadOrError_Queue_SS					fOutQueue;
+
+	PaylodOrErrorProcFun							fCartridgeFun;
+
+	std::atomic< bool >							fScheduled {};
+
+	std::vector< PayloadOrError >				fInBatch, fOutBatch;
+};
+
+
+// The out queue is unbounded - a thread of the pool must never wait on a full queue,
+// since the stage which would make place can be waiting for this very thread.
+export inline auto operator | ( NB_PayloadOrError_Queue_SS in_queue, NB_PooledStage && s ) -> NB_PayloadOrError_Queue_SS
+{
+	auto		out_queue_sp( std::make_shared< NB_PayloadOrError_Queue >() );
+	out_queue_sp->set_stats( in_queue->stats() );		// this stage is not instrumented, but the next ones can be
+
+	auto		theStage( std::make_shared< NB_PooledStageTask >( s.fPool, in_queue, out_queue_sp, std::move( s.fFun ) ) );
+
+	in_queue->set_on_push( [ theStage ]() { theStage->Schedule(); } );
+
+	theStage->Schedule();		// there can be something in in_queue already
+
+	return out_queue_sp;
+}
+
+
+// The coroutine version of the parallel pipe - the stages are not blocked in pop,
+// but suspended in co_await, and resumed by the threads of the pool
+export using NB_PayloadOrError_AsyncQueue = TAsyncQueue< PayloadOrError >;
+
+export using NB_PayloadOrError_AsyncQueue_SS = std::shared_ptr< NB_PayloadOrError_AsyncQueue >;
+
+// Any coroutine like this can be a stage
+export using NB_AsyncStageFun = std::function< TAsyncTask ( NB_PayloadOrError_AsyncQueue_SS in_q, NB_PayloadOrError_AsyncQueue_SS out_q ) >;
+
+
+// The coroutine counterpart of NB_ParPipe_Fun_Loop.
+// The parameters are taken by value, since they must live in the coroutine frame.
+inline TAsyncTask	NB_AsyncPipe_Fun_Loop( NB_PayloadOrError_AsyncQueue_SS in_q, NB_PayloadOrError_AsyncQueue_SS out_q, PaylodOrErrorProcFun theCartridgeFun )
+{
+	co_await resume_on( in_q->pool() );		// do not run in the thread which builds the pipe
+
+	for( auto pop_elem = co_await in_q->pop_async(); pop_elem; pop_elem = co_await in_q->pop_async() )		// here the coroutine can be suspended
+		out_q->push( theCartridgeFun( std::move( * pop_elem ) ) );
+
+	// Pass the end of the data further on, and finish the coroutine
+	if( in_q->is_cancelled() )
+		out_q->cancel();
+	else
+		out_q->close();
+}
+
+
+// The out queue uses the same pool as the in queue
+export inline auto operator | ( NB_PayloadOrError_AsyncQueue_SS in_queue, PaylodOrErrorProcFun && f ) -> NB_PayloadOrError_AsyncQueue_SS
+{
+	auto		out_queue_sp( std::make_shared< NB_PayloadOrError_AsyncQueue >( in_queue->pool() ) );
+
+	NB_AsyncPipe_Fun_Loop( in_queue, out_queue_sp, std::move( f ) );		// runs until the first co_await
+
+	return out_queue_sp;
+}
+
+
+// A stage can also be a coroutine written by the user - then it has the full control
+// of what and when is taken and passed on
+export inline auto operator | ( NB_PayloadOrError_AsyncQueue_SS in_queue, NB_AsyncStageFun && coro ) -> NB_PayloadOrError_AsyncQueue_SS
+{
+	auto		out_queue_sp( std::make_shared< NB_PayloadOrError_AsyncQueue >( in_queue->pool() ) );
+
+	coro( in_queue, out_queue_sp );
+
+	return out_queue_sp;
+}
+
+
+
+
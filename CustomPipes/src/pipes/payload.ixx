@@ -8,18 +8,52 @@ export module payload;
 
 
 
+import <cstddef>;
+import <cassert>;
+import <algorithm>;
+import <array>;
+import <span>;
+import <vector>;
 import <string>;
+import <string_view>;
+import <memory_resource>;
 import <expected>;
 
 
 
-// We have a data structure to process
+// We have a data structure to process.
+// Its string can live in the memory given by the user (see MakePayload) - moving the payload
+// moves also its buffer, and when the payload is destroyed the buffer goes back to that memory.
 export struct Payload
 {
-	std::string	fStr	{};
-	int			fVal	{};
+	std::pmr::string	fStr	{};
+	int					fVal	{};
 };
 
+
+// The memory of the strings of one pipe. The strings are allocated by the producer and freed
+// wherever the objects end (e.g. in the sink), i.e. by different threads, so it is synchronized.
+// The freed blocks are reused by the next objects - in the steady state there are no calls to malloc.
+// Whether this is faster than the default memory depends on the malloc of the system (see the bench).
+export class PayloadMemory : public std::pmr::synchronized_pool_resource
+{
+public:
+
+	// The blocks up to kLargestBlock bytes are pooled - the bigger ones go straight to the system.
+	// The default of the library is too small for the kilobyte strings.
+	static constexpr std::size_t	kLargestBlock { 1 << 16 };
+
+	PayloadMemory() : std::pmr::synchronized_pool_resource( std::pmr::pool_options { 0, kLargestBlock } ) {}
+
+	PayloadMemory & operator = ( PayloadMemory && ) = delete;
+};
+
+// Makes the payload with its string in mem (the default memory if none)
+export inline Payload MakePayload( std::string_view str, int val, std::pmr::memory_resource * mem = std::pmr::get_default_resource() )
+{
+	return Payload { std::pmr::string( str, mem ), val };
+}
+
 // Some error types just for the example
 export enum class OpErrorType : unsigned char { kInvalidInput, kOverflow, kUnderflow };
 
@@ -29,3 +63,158 @@ export using PayloadOrError = std::expected< Payload, OpErrorType >;
 
 
 
+
+// -----------------------------------------------------------
+// The small payload - most of the strings are short tags, so here the string
+// is kept inside the object: no heap, no pointer to follow, and the whole
+// expected fits in 32 bytes. It is also a literal type, so unlike Payload it can be
+// used in the constant evaluation (see the compile-time pipes).
+
+
+// The string of at most N chars in the object itself. Copying it is copying N + 1 bytes,
+// so it is meant for the short strings.
+export template < std::size_t N >
+requires ( N > 0 && N < 256 )
+class TInlineString
+{
+
+public:
+
+	static constexpr std::size_t	kCapacity { N };
+
+	constexpr TInlineString() = default;
+
+	// str must fit - otherwise it is cut to kCapacity chars
+	constexpr TInlineString( std::string_view str )
+	{
+		assert( str.size() <= kCapacity );
+		fSize = static_cast< unsigned char >( std::min( str.size(), kCapacity ) );
+		std::ranges::copy( str.substr( 0, fSize ), fChars.begin() );
+	}
+
+	constexpr TInlineString( const char * str ) : TInlineString( std::string_view( str ) ) {}
+
+public:
+
+	constexpr std::size_t size() const { return fSize; }
+	constexpr bool empty() const { return fSize == 0; }
+
+	constexpr std::string_view view() const { return { fChars.data(), fSize }; }
+	constexpr operator std::string_view () const { return view(); }
+
+	// Returns false, with the string untouched, if str does not fit
+	constexpr bool append( std::string_view str )
+	{
+		if( str.size() > kCapacity - fSize )
+			return false;
+
+		std::ranges::copy( str, fChars.begin() + fSize );
+		fSize += static_cast< unsigned char >( str.size() );
+		return true;
+	}
+
+	friend constexpr bool operator == ( const TInlineString & a, const TInlineString & b ) { return a.view() == b.view(); }
+
+private:
+
+	std::array< char, N >	fChars {};
+
+	unsigned char				fSize {};
+
+};
+
+
+export template < std::size_t N = 23 >
+struct TSmallPayload
+{
+	TInlineString< N >	fStr	{};
+	int						fVal	{};
+};
+
+export using SmallPayload = TSmallPayload<>;
+
+// The same errors as for PayloadOrError - e.g. kOverflow if the string does not fit
+export using SmallPayloadOrError = std::expected< SmallPayload, OpErrorType >;
+
+
+
+
+// -----------------------------------------------------------
+// The structure-of-arrays (SoA) form of a batch of PayloadOrError.
+// Each field is in its own column, so a loop over e.g. the values touches only the ints
+// lying one after another, and the compiler can vectorize it - rather than calling
+// a function per object. The error lanes are marked in fValid, so the loop can skip them
+// with no branch:
+//
+//		for( std::size_t i {}; i < theBatch.size(); ++ i )
+//			theBatch.fVals[ i ] += theBatch.fValid[ i ] ? 2 : 0;
+//
+export struct TPayloadBatch
+{
+	std::vector< int >						fVals;
+	std::vector< std::pmr::string >		fStrs;			// the strings are moved in and out with their memory
+	std::vector< unsigned char >			fValid;			// 1 - a payload, 0 - an error (not bool - std::vector< bool > is packed into bits)
+	std::vector< OpErrorType >				fErrors;			// valid only where fValid is 0
+
+	std::size_t size() const { return fVals.size(); }
+	bool empty() const { return fVals.empty(); }
+
+	void reserve( std::size_t n )
+	{
+		fVals.reserve( n ), fStrs.reserve( n ), fValid.reserve( n ), fErrors.reserve( n );
+	}
+
+	void clear()
+	{
+		fVals.clear(), fStrs.clear(), fValid.clear(), fErrors.clear();
+	}
+
+	void push_back( PayloadOrError && e )
+	{
+		fValid.push_back( e.has_value() );
+		fErrors.push_back( e ? OpErrorType {} : e.error() );
+		fVals.push_back( e ? e->fVal : 0 );
+		fStrs.push_back( e ? std::move( e->fStr ) : std::pmr::string {} );
+	}
+
+	// Moves the i-th object out of the batch
+	PayloadOrError take( std::size_t i )
+	{
+		assert( i < size() );
+		if( not fValid[ i ] )
+			return std::unexpected( fErrors[ i ] );
+		return Payload { std::move( fStrs[ i ] ), fVals[ i ] };
+	}
+
+	// Puts e in place of the i-th object (e.g. the one taken out before)
+	void put( std::size_t i, PayloadOrError && e )
+	{
+		assert( i < size() );
+		fValid[ i ] = e.has_value();
+		if( e )
+			fVals[ i ] = e->fVal, fStrs[ i ] = std::move( e->fStr );
+		else
+			fErrors[ i ] = e.error();
+	}
+
+	// The batch of elems, which are moved from
+	void assign( std::span< PayloadOrError > elems )
+	{
+		clear();
+		reserve( elems.size() );
+		for( auto & e : elems )
+			push_back( std::move( e ) );
+	}
+
+	// Moves all the objects to the end of out - the batch is cleared
+	void move_to( std::vector< PayloadOrError > & out )
+	{
+		out.reserve( out.size() + size() );
+		for( std::size_t i {}; i < size(); ++ i )
+			out.push_back( take( i ) );
+		clear();
+	}
+};
+
+
+
@@ -0,0 +1,58 @@
+// ---------------------------------------------------
+// Created by Boguslaw Cyganek (C) 2024
+// ---------------------------------------------------
+
+
+export module payload_stages;
+
+
+
+
+import <utility>;
+
+import payload;
+import batch_stage;
+
+
+
+// -----------------------------------------------------------
+// The simple stages of PayloadOrError - used by the demos of the parallel pipe,
+// and by its benchmarks, so both measure the same work.
+//
+
+
+
+
+export inline auto add_2( PayloadOrError && a )
+{
+	if( a ) 
+		a->fStr += "_2", a->fVal += 2;
+	return std::move( a );
+}
+
+
+export inline auto add_3( PayloadOrError && a )
+{
+	if( a )
+		a->fStr += "_3",	a->fVal += 3;
+	return std::move( a );
+}
+
+
+// The same as add_2 and add_3, but on the whole batch at once (see batch())
+export inline void add_2_batch( TPayloadBatch & b )
+{
+	append_to_strs( b, "_2" );
+	add_to_vals( b, 2 );
+}
+
+export inline void add_3_batch( TPayloadBatch & b )
+{
+	append_to_strs( b, "_3" );
+	add_to_vals( b, 3 );
+}
+
+
+
+
+
@@ -0,0 +1,193 @@
+// ---------------------------------------------------
+// Created by Boguslaw Cyganek (C) 2024
+// ---------------------------------------------------
+
+
+export module pipe_stage;
+
+
+
+
+import <cstddef>;
+import <tuple>;
+import <utility>;
+import <functional>;
+import <type_traits>;
+import <concepts>;
+import <expected>;
+
+
+
+// -----------------------------------------------------------
+// The compile-time fused stages.
+// A few stage functions are joined into one callable, which calls them one after another.
+// All of them are kept with their own types (no std::function), so the compiler
+// can inline the whole chain into one loop body.
+// Examples:
+//
+//		auto f = fuse( fn< add_2 >, fn< add_3 >, fn< add_2 > );
+//		auto g = fuse( fn< add_2 > ) | fn< add_3 > | []( auto && a ) { return a; };
+//
+//		auto out_q = ( in_q | f | split() | g ).run();		// two threads - the boundaries are only where we put them
+//
+// The parallel pipe fuses the stages joined to a queue in the same way, so in_q | add_2 | add_3 is one thread too.
+//
+
+
+
+
+// Wraps a function known at compile time. A pointer to a function passed as a parameter
+// is a run-time value, so the call goes through the pointer - here it is a direct call.
+export template < auto Fun >
+struct TFunStage
+{
+	template < typename Arg >
+	requires std::invocable< decltype( Fun ), Arg >		// so std::invocable< TFunStage, X > tells the truth (e.g. in the serial pipe)
+	constexpr decltype( auto ) operator () ( Arg && arg ) const
+	{
+		return std::invoke( Fun, std::forward< Arg >( arg ) );
+	}
+};
+
+export template < auto Fun >
+constexpr TFunStage< Fun > fn {};
+
+
+
+
+export template < typename ... Funs >
+class TFusedStage;
+
+
+
+// The type of the argument of a stage function - it is known only if the function is not a template,
+// i.e. for a function, fn< f > of a function, a lambda with no auto parameter, and the fused stage
+// which starts with one of them. Otherwise there is no type.
+export template < typename F >
+struct TStageArg {};
+
+template < typename R, typename A >
+struct TStageArg< R ( * )( A ) > { using type = A; };
+
+template < typename R, typename A >
+struct TStageArg< R ( * )( A ) noexcept > { using type = A; };
+
+template < typename R, typename C, typename A >
+struct TStageArg< R ( C:: * )( A ) const > { using type = A; };
+
+template < typename R, typename C, typename A >
+struct TStageArg< R ( C:: * )( A ) const noexcept > { using type = A; };
+
+template < typename F >
+requires requires { & F::operator (); }
+struct TStageArg< F > : TStageArg< decltype( & F::operator () ) > {};
+
+template < auto Fun >
+struct TStageArg< TFunStage< Fun > > : TStageArg< decltype( Fun ) > {};
+
+template < typename First, typename ... Rest >
+struct TStageArg< TFusedStage< First, Rest ... > > : TStageArg< First > {};
+
+
+
+// Whether the functions can be called one after another, the first one with Arg
+template < typename Arg, typename Fun, typename ... Rest >
+constexpr bool IsChainInvocable()
+{
+	if constexpr( not std::invocable< const Fun &, Arg > )
+		return false;
+	else if constexpr( sizeof ... ( Rest ) == 0 )
+		return true;
+	else
+		return IsChainInvocable< std::invoke_result_t< const Fun &, Arg >, Rest ... >();
+}
+
+// Fun can be appended to Chain if it takes the result of Chain. If the argument of Chain is not known
+// (e.g. it starts with a generic lambda), then this is checked only when the chain is called.
+template < typename Chain, typename Fun >
+concept AppendableTo = ( not requires { typename TStageArg< Chain >::type; } )
+								|| std::invocable< const Fun &, std::invoke_result_t< const Chain &, typename TStageArg< Chain >::type > >;
+
+
+
+export template < typename ... Funs >
+class TFusedStage
+{
+
+public:
+
+	constexpr explicit TFusedStage( Funs ... funs ) : fFuns( std::move( funs ) ... ) {}
+
+	// The number of the functions in the chain
+	static constexpr std::size_t size() { return sizeof ... ( Funs ); }
+
+	// Passes arg through all the functions, from the first to the last one
+	template < typename Arg >
+	requires ( IsChainInvocable< Arg &&, Funs ... >() )		// so a wrong chain is reported where it is called, not in Apply
+	constexpr auto operator () ( Arg && arg ) const
+	{
+		return Apply< 0 >( std::forward< Arg >( arg ) );
+	}
+
+	// Appends one more function to the fused chain - it must take what the chain returns
+	template < typename Fun >
+	requires AppendableTo< TFusedStage, std::decay_t< Fun > >
+	friend constexpr auto operator | ( TFusedStage && stage, Fun && f ) -> TFusedStage< Funs ..., std::decay_t< Fun > >
+	{
+		return std::apply(	[ & f ]( auto && ... funs )
+									{
+										return TFusedStage< Funs ..., std::decay_t< Fun > >( std::move( funs ) ..., std::forward< Fun >( f ) );
+									},
+									std::move( stage.fFuns ) );
+	}
+
+private:
+
+	template < std::size_t I, typename Arg >
+	constexpr auto Apply( Arg && arg ) const
+	{
+		if constexpr( I + 1 == sizeof ... ( Funs ) )
+			return std::invoke( std::get< I >( fFuns ), std::forward< Arg >( arg ) );
+		else
+			return Apply< I + 1 >( std::invoke( std::get< I >( fFuns ), std::forward< Arg >( arg ) ) );
+	}
+
+private:
+
+	std::tuple< Funs ... >		fFuns;
+
+	static_assert( sizeof ... ( Funs ) > 0 );
+
+};
+
+
+
+// Makes the fused stage out of the callables
+export template < typename ... Funs >
+constexpr auto fuse( Funs && ... funs )
+{
+	return TFusedStage< std::decay_t< Funs > ... >( std::forward< Funs >( funs ) ... );
+}
+
+
+
+
+// -----------------------------------------------------------
+// The objects passed between the stages of the std::expected pipes - the serial ones
+// (see simple_custom_pipe_serial.cpp, custom_pipe_serial.cpp) and the typed parallel one.
+export template < typename T >
+concept is_expected = requires( T t )
+{
+	typename T::value_type;		// type requirement - nested member name exists
+	typename T::error_type;		// type requirement - nested member name exists
+
+	requires std::is_constructible_v< bool, T >;		// std::convertible_to< T, bool > will not work - ok, there is a conversion but this is a CONTEXTUAL CONVERSION!
+	requires std::same_as< decltype( * t ), typename T::value_type & >;
+	requires std::same_as< std::remove_cvref_t< decltype( * t ) >, typename T::value_type >;
+
+	requires std::constructible_from< T, std::unexpected< typename T::error_type > >; 
+};
+
+
+
+
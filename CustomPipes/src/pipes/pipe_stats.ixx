@@ -0,0 +1,377 @@
+// ---------------------------------------------------
+// Created by Boguslaw Cyganek (C) 2024
+// ---------------------------------------------------
+
+
+export module pipe_stats;
+
+
+
+
+import <cstddef>;
+import <cstdint>;
+import <cassert>;
+import <string>;
+import <string_view>;
+import <format>;
+import <vector>;
+import <deque>;
+import <array>;
+import <algorithm>;
+import <bit>;
+import <memory>;
+import <mutex>;
+import <condition_variable>;
+import <atomic>;
+import <chrono>;
+import <thread>;
+import <stop_token>;
+import <functional>;
+import <iostream>;
+
+
+
+// -----------------------------------------------------------
+// The instrumentation of the parallel pipe.
+// Each stage can record how many objects it took and passed on, how long it waited in pop,
+// how long its function worked, the depth of its in queue, and the histogram of the time
+// spent on each object. It is off by default - then a stage has only a null pointer,
+// and checks it once per batch (and once per object), so the cost is near zero.
+// Usage:
+//
+//		auto theStats = std::make_shared< TPipeStats >();
+//		theFirstQueue->set_stats( theStats );			// the stages joined after this are instrumented
+//		auto thePipe = ( theFirstQueue | add_2 | parallel( 4, heavy_add_5 ) | add_3 ).run();
+//		TStatsReporter	theReporter( theStats, 1s );		// prints the stats once per second
+//		...
+//		std::cout << theStats->to_json();
+//
+
+
+
+export using StatsClock = std::chrono::steady_clock;
+
+
+
+// The log-linear histogram of the durations in nanoseconds - as in HdrHistogram, each power of two
+// is split into kSubBuckets buckets, so the relative error is below 1 / kSubBuckets at any scale.
+// Recording is one relaxed atomic increment, so it can be called by many threads at once.
+export class TLatencyHistogram
+{
+
+public:
+
+	static constexpr std::size_t	kSubBits		{ 3 };
+	static constexpr std::size_t	kSubBuckets		{ 1 << kSubBits };
+	static constexpr std::size_t	kNumOfBuckets	{ ( 64 - kSubBits + 1 ) * kSubBuckets };
+
+public:
+
+	void Record( std::uint64_t ns )
+	{
+		fBuckets[ Bucket( ns ) ].fetch_add( 1, std::memory_order_relaxed );
+	}
+
+	// Returns the (approximate) duration below which there is the q fraction of the recorded ones,
+	// e.g. q = 0.99 for p99. Returns 0 if nothing was recorded.
+	std::uint64_t Percentile( double q ) const
+	{
+		assert( q >= 0.0 && q <= 1.0 );
+
+		std::array< std::uint64_t, kNumOfBuckets >	counts {};
+		std::uint64_t	total {};
+		for( std::size_t i {}; i < kNumOfBuckets; ++ i )
+			total += counts[ i ] = fBuckets[ i ].load( std::memory_order_relaxed );
+
+		if( total == 0 )
+			return 0;
+
+		const auto rank = std::max< std::uint64_t >( 1, static_cast< std::uint64_t >( q * total + 0.5 ) );
+
+		std::uint64_t	cumulative {};
+		for( std::size_t i {}; i < kNumOfBuckets; ++ i )
+			if( ( cumulative += counts[ i ] ) >= rank )
+				return ( LowerBound( i ) + LowerBound( i + 1 ) ) / 2;		// the middle of the bucket
+
+		return LowerBound( kNumOfBuckets - 1 );
+	}
+
+private:
+
+	static std::size_t Bucket( std::uint64_t ns )
+	{
+		if( ns < kSubBuckets )
+			return ns;		// the smallest values are exact
+
+		const std::size_t msb = std::bit_width( ns ) - 1;
+		return ( msb - kSubBits + 1 ) * kSubBuckets + ( ( ns >> ( msb - kSubBits ) ) & ( kSubBuckets - 1 ) );
+	}
+
+	static std::uint64_t LowerBound( std::size_t bucket )
+	{
+		if( bucket < kSubBuckets )
+			return bucket;
+
+		const auto octave = bucket / kSubBuckets;
+		return ( kSubBuckets + bucket % kSubBuckets ) << ( octave - 1 );
+	}
+
+private:
+
+	std::array< std::atomic< std::uint64_t >, kNumOfBuckets >	fBuckets {};
+
+};
+
+
+
+// The depth of a queue - recorded by the queue itself, at each push, under its lock
+export class TQueueStats
+{
+
+public:
+
+	void Record( std::size_t depth )
+	{
+		if( depth > fMaxDepth.load( std::memory_order_relaxed ) )		// only one thread writes at a time (the queue is locked)
+			fMaxDepth.store( depth, std::memory_order_relaxed );
+
+		fDepthSum.fetch_add( depth, std::memory_order_relaxed );
+		fSamples.fetch_add( 1, std::memory_order_relaxed );
+	}
+
+	std::size_t MaxDepth() const { return fMaxDepth.load( std::memory_order_relaxed ); }
+
+	double AvgDepth() const
+	{
+		const auto n = fSamples.load( std::memory_order_relaxed );
+		return n > 0 ? static_cast< double >( fDepthSum.load( std::memory_order_relaxed ) ) / n : 0.0;
+	}
+
+private:
+
+	std::atomic< std::size_t >		fMaxDepth {};
+	std::atomic< std::uint64_t >	fDepthSum {};
+	std::atomic< std::uint64_t >	fSamples {};
+
+};
+
+
+
+// What a stage did until now - a copy of the counters taken at one moment
+export struct TStageStatsSnapshot
+{
+	std::string			fName;
+
+	std::uint64_t		fItemsIn {};
+	std::uint64_t		fItemsOut {};
+
+	double				fPopWaitMs {};			// the total time blocked in pop (by all replicas)
+	double				fCartridgeMs {};		// the total time in the stage function
+
+	std::size_t			fMaxQueueDepth {};		// of the in queue
+	double				fAvgQueueDepth {};
+
+	double				fLatencyP50Us {};		// the time of the stage function per object
+	double				fLatencyP99Us {};
+};
+
+
+
+// The counters of one stage. All replicas of a stage share one object of this class.
+export class TStageStats
+{
+
+public:
+
+	explicit TStageStats( std::string name ) : fName( std::move( name ) ) {}
+
+	TStageStats & operator = ( TStageStats && ) = delete;
+
+public:
+
+	// After each pop (or pop_bulk) - n objects taken after waiting for wait_time
+	void RecordPop( StatsClock::duration wait_time, std::size_t n )
+	{
+		fPopWaitNs.fetch_add( ToNs( wait_time ), std::memory_order_relaxed );
+		fItemsIn.fetch_add( n, std::memory_order_relaxed );
+	}
+
+	// After the stage function processed one object
+	void RecordItem( StatsClock::duration fun_time )
+	{
+		const auto ns = ToNs( fun_time );
+		fCartridgeNs.fetch_add( ns, std::memory_order_relaxed );
+		fLatency.Record( ns );
+	}
+
+	void RecordPush( std::size_t n )
+	{
+		fItemsOut.fetch_add( n, std::memory_order_relaxed );
+	}
+
+	// To be given to the in queue of the stage
+	TQueueStats & in_queue_stats() { return fInQueue; }
+
+	const std::string & name() const { return fName; }
+
+	TStageStatsSnapshot snapshot() const
+	{
+		return TStageStatsSnapshot {
+			fName,
+			fItemsIn.load( std::memory_order_relaxed ),
+			fItemsOut.load( std::memory_order_relaxed ),
+			fPopWaitNs.load( std::memory_order_relaxed ) * 1e-6,
+			fCartridgeNs.load( std::memory_order_relaxed ) * 1e-6,
+			fInQueue.MaxDepth(),
+			fInQueue.AvgDepth(),
+			fLatency.Percentile( 0.50 ) * 1e-3,
+			fLatency.Percentile( 0.99 ) * 1e-3
+		};
+	}
+
+private:
+
+	static std::uint64_t ToNs( StatsClock::duration d )
+	{
+		return static_cast< std::uint64_t >( std::chrono::duration_cast< std::chrono::nanoseconds >( d ).count() );
+	}
+
+private:
+
+	const std::string					fName;
+
+	std::atomic< std::uint64_t >		fItemsIn {};
+	std::atomic< std::uint64_t >		fItemsOut {};
+	std::atomic< std::uint64_t >		fPopWaitNs {};
+	std::atomic< std::uint64_t >		fCartridgeNs {};
+
+	TQueueStats							fInQueue;
+
+	TLatencyHistogram					fLatency;
+
+};
+
+
+
+// The stats of all stages of a pipe, in the order of the stages
+export class TPipeStats
+{
+
+public:
+
+	// Called when a stage is joined to the pipe - the returned object lives as long as this one
+	TStageStats & add_stage( std::string_view kind )
+	{
+		std::unique_lock	theLock( fMutex );
+		return fStages.emplace_back( std::format( "#{} {}", fStages.size() + 1, kind ) );		// std::deque does not move its elements
+	}
+
+	std::vector< TStageStatsSnapshot > snapshot() const
+	{
+		std::unique_lock	theLock( fMutex );
+
+		std::vector< TStageStatsSnapshot >	out;
+		out.reserve( fStages.size() );
+		for( const auto & s : fStages )
+			out.push_back( s.snapshot() );
+		return out;
+	}
+
+	// One line per stage
+	std::string to_text() const
+	{
+		std::string		out;
+		for( const auto & s : snapshot() )
+			out += std::format( "{}: in={} out={} pop_wait={:.3f}ms fun={:.3f}ms depth(max/avg)={}/{:.2f} p50={:.3f}us p99={:.3f}us\n",
+										s.fName, s.fItemsIn, s.fItemsOut, s.fPopWaitMs, s.fCartridgeMs,
+										s.fMaxQueueDepth, s.fAvgQueueDepth, s.fLatencyP50Us, s.fLatencyP99Us );
+		return out;
+	}
+
+	// The array of the stage objects
+	std::string to_json() const
+	{
+		std::string		out { "[" };
+		for( bool first { true }; const auto & s : snapshot() )
+		{
+			out += std::format( "{}\n  {{ \"stage\": \"{}\", \"items_in\": {}, \"items_out\": {}, \"pop_wait_ms\": {:.3f}, \"fun_ms\": {:.3f}, "
+										"\"max_queue_depth\": {}, \"avg_queue_depth\": {:.2f}, \"p50_us\": {:.3f}, \"p99_us\": {:.3f} }}",
+										first ? "" : ",", s.fName, s.fItemsIn, s.fItemsOut, s.fPopWaitMs, s.fCartridgeMs,
+										s.fMaxQueueDepth, s.fAvgQueueDepth, s.fLatencyP50Us, s.fLatencyP99Us );
+			first = false;
+		}
+		return out += "\n]\n";
+	}
+
+private:
+
+	mutable std::mutex				fMutex;
+
+	std::deque< TStageStats >		fStages;
+
+};
+
+
+
+// Dumps the stats periodically in its own thread - and once more when it is destroyed
+export class TStatsReporter
+{
+
+public:
+
+	enum class EFormat { kText, kJson };
+
+	using Sink = std::function< void ( const std::string & ) >;
+
+	TStatsReporter( std::shared_ptr< const TPipeStats > stats, StatsClock::duration period, EFormat format = EFormat::kText,
+						Sink sink = []( const std::string & s ) { std::cout << s << std::flush; } )
+		: fStats( std::move( stats ) ), kPeriod( period ), kFormat( format ), fSink( std::move( sink ) )
+	{
+		assert( fStats );
+		fThread = std::jthread( [ this ]( std::stop_token st ) { Loop( st ); } );
+	}
+
+	~TStatsReporter()
+	{
+		fThread.request_stop();
+		fThread.join();
+		Dump();		// the final state
+	}
+
+	TStatsReporter & operator = ( TStatsReporter && ) = delete;
+
+private:
+
+	void Loop( std::stop_token st )
+	{
+		std::mutex		theMutex;
+		std::unique_lock	theLock( theMutex );
+
+		// wait_for returns at once when the stop is requested
+		while( not fCondVar.wait_for( theLock, st, kPeriod, [ & st ]() { return st.stop_requested(); } ) )
+			Dump();
+	}
+
+	void Dump() const
+	{
+		fSink( kFormat == EFormat::kJson ? fStats->to_json() : fStats->to_text() );
+	}
+
+private:
+
+	std::shared_ptr< const TPipeStats >		fStats;
+
+	const StatsClock::duration					kPeriod;
+
+	const EFormat									kFormat;
+
+	Sink												fSink;
+
+	std::condition_variable_any				fCondVar;
+
+	std::jthread									fThread;		// the last one - started when all the rest is ready
+
+};
+
+
+
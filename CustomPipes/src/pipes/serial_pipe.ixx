@@ -0,0 +1,143 @@
+// ---------------------------------------------------
+// Created by Boguslaw Cyganek (C) 2024
+// ---------------------------------------------------
+
+
+export module serial_pipe;
+
+
+
+
+import <cstddef>;
+import <tuple>;
+import <utility>;
+import <functional>;
+import <type_traits>;
+import <concepts>;
+import <expected>;
+import <ranges>;
+
+import pipe_stage;
+
+
+
+// -----------------------------------------------------------
+// The serial pipe-line with std::expected - the operators | joining an object with the stage functions,
+// and the composed pipe (see simple_custom_pipe_serial.cpp for the examples, and the bench project).
+//
+// There are two modes of the pipe - chosen by the signature of the stage function:
+//
+// 1. The stage takes std::expected - then it is always called, and it is its responsibility to check
+//		if the passed object has a value or an error (see Payload_Proc_1..3).
+// 2. The stage takes the value (see Payload_Step_1..3) - then it is called only if there is a value.
+//		After the first error the rest of the stages are not called at all (short-circuit) - each next |
+//		is only one branch, and the error is passed on in the std::expected returned by the skipped stage.
+//
+// In both modes the stages can take and return std::expected of different types.
+
+
+// Mode 1 - all functions in the pipe are called
+export template < typename InT, typename InE, typename Function >
+requires std::invocable< Function, std::expected< InT, InE > >
+			&& is_expected< typename std::invoke_result_t< Function, std::expected< InT, InE > > >
+constexpr auto operator | ( std::expected< InT, InE > && ex, Function && f ) -> typename std::invoke_result_t< Function, std::expected< InT, InE > >
+{
+	return std::invoke( std::forward< Function >( f ), /***/ std::forward< std::expected< InT, InE > >( ex ) );
+}
+
+// Mode 2 - if there is an error in the pipeline, then the further functions in the chain are NOT called.
+// The error is converted to the error type of the skipped stage, so it must be constructible from InE.
+export template < typename InT, typename InE, typename Function >
+requires ( not std::invocable< Function, std::expected< InT, InE > > )		// otherwise it is mode 1
+			&& std::invocable< Function, InT >
+			&& is_expected< typename std::invoke_result_t< Function, InT > >
+			&& std::constructible_from< typename std::invoke_result_t< Function, InT >::error_type, InE >
+constexpr auto operator | ( std::expected< InT, InE > && ex, Function && f ) -> typename std::invoke_result_t< Function, InT >
+{
+	if( ex ) [[likely]]
+		return std::invoke( std::forward< Function >( f ), * std::move( ex ) );
+
+	return typename std::invoke_result_t< Function, InT >( std::unexpect, std::move( ex ).error() );
+}
+
+
+// The composed pipe - the stages with no input, joined once and then run on many objects.
+// Each object goes through the operators | above (so in both modes), but the chain is not built again,
+// and the stages are kept with their own types, so the calls can be inlined (pass fn< f > rather than
+// f to have a direct call, not through a pointer). The chain starts with compose(), since
+// Payload_Proc_1 | Payload_Proc_2 would be the operator | of two functions, which cannot be overloaded.
+// Examples:
+//
+//		auto p = compose( Payload_Proc_1 ) | Payload_Proc_2 | Payload_Proc_3;
+//
+//		auto res = p( PayloadOrError { Payload { "Start string ", 42 } } );		// or ... | p
+//
+//		for( auto && r : theInputs | p )		// lazily, as std::views::transform
+//			...
+//
+export template < typename ... Funs >
+class TComposedPipe
+{
+
+public:
+
+	constexpr explicit TComposedPipe( Funs ... funs ) : fFuns( std::move( funs ) ... ) {}
+
+	// Passes ex through all the stages
+	template < typename T, typename E >
+	constexpr auto operator () ( std::expected< T, E > && ex ) const
+	{
+		return Apply< 0 >( std::move( ex ) );
+	}
+
+	// Appends one more stage
+	template < typename Fun >
+	friend constexpr auto operator | ( TComposedPipe && pipe, Fun && f ) -> TComposedPipe< Funs ..., std::decay_t< Fun > >
+	{
+		return std::apply(	[ & f ]( auto && ... funs )
+									{
+										return TComposedPipe< Funs ..., std::decay_t< Fun > >( std::move( funs ) ..., std::forward< Fun >( f ) );
+									},
+									std::move( pipe.fFuns ) );
+	}
+
+	// Runs the pipe on each object of the range - the objects are copied in, unless the range
+	// gives rvalues (the pipe is copied as well, so the view does not refer to a temporary)
+	template < std::ranges::viewable_range R >
+	friend constexpr auto operator | ( R && r, const TComposedPipe & pipe )
+	{
+		return std::forward< R >( r ) | std::views::transform(	[ pipe ]( auto && x )
+																					{
+																						return pipe( std::remove_cvref_t< decltype( x ) >( std::forward< decltype( x ) >( x ) ) );
+																					} );
+	}
+
+private:
+
+	template < std::size_t I, typename Ex >
+	constexpr auto Apply( Ex && ex ) const
+	{
+		if constexpr( I + 1 == sizeof ... ( Funs ) )
+			return std::move( ex ) | std::get< I >( fFuns );
+		else
+			return Apply< I + 1 >( std::move( ex ) | std::get< I >( fFuns ) );
+	}
+
+private:
+
+	std::tuple< Funs ... >		fFuns;
+
+	static_assert( sizeof ... ( Funs ) > 0 );
+
+};
+
+// Makes the composed pipe out of the stages
+export template < typename ... Funs >
+constexpr auto compose( Funs && ... funs )
+{
+	return TComposedPipe< std::decay_t< Funs > ... >( std::forward< Funs >( funs ) ... );
+}
+
+
+
+
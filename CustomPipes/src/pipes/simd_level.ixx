@@ -0,0 +1,56 @@
+// ---------------------------------------------------
+// Created by Boguslaw Cyganek (C) 2024
+// ---------------------------------------------------
+
+
+module;
+
+#include "simd_target.h"
+
+export module simd_level;
+
+
+
+// -----------------------------------------------------------
+// The SIMD level of this CPU - the modules with the SIMD kernels (similarity, batch_stage)
+// compile all of them, and call the one of the level checked here.
+//
+
+
+
+export enum class ESimdLevel { kScalar, kAVX2, kAVX512 };
+
+// The best level of this CPU (checked once)
+export inline ESimdLevel SimdLevel()
+{
+	static const ESimdLevel kLevel = []
+	{
+	#if defined( SIMD_X86 ) && defined( _MSC_VER )
+		int regs[ 4 ] {};
+		__cpuid( regs, 1 );
+		const bool osxsave { ( regs[ 2 ] & ( 1 << 27 ) ) != 0 };
+		if( not osxsave )
+			return ESimdLevel::kScalar;
+
+		const auto xcr0 { _xgetbv( 0 ) };
+		__cpuidex( regs, 7, 0 );
+		if( ( regs[ 1 ] & ( 1 << 16 ) ) && ( xcr0 & 0xe6 ) == 0xe6 )		// AVX-512F, and the OS saves the ZMM registers
+			return ESimdLevel::kAVX512;
+		if( ( regs[ 1 ] & ( 1 << 5 ) ) && ( xcr0 & 0x6 ) == 0x6 )			// AVX2, and the OS saves the YMM registers
+			return ESimdLevel::kAVX2;
+	#elif defined( SIMD_X86 )
+		if( __builtin_cpu_supports( "avx512f" ) )
+			return ESimdLevel::kAVX512;
+		if( __builtin_cpu_supports( "avx2" ) )
+			return ESimdLevel::kAVX2;
+	#endif
+		return ESimdLevel::kScalar;
+	} ();
+
+	return kLevel;
+}
+
+
+
+
+
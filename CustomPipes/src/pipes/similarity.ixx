@@ -0,0 +1,753 @@
+// ---------------------------------------------------
+// Created by Boguslaw Cyganek (C) 2024
+// ---------------------------------------------------
+
+
+module;
+
+#include "simd_target.h"		// the SIMD kernels are chosen at run time (see SimdLevel())
+
+export module similarity;
+
+
+
+
+import <cstddef>;
+import <cassert>;
+import <algorithm>;
+import <vector>;
+import <utility>;
+import <tuple>;
+import <limits>;
+import <latch>;
+import <span>;
+import <concepts>;
+
+import dense_matrix;
+import thread_pool;
+export import simd_level;		// ESimdLevel, SimdLevel()
+
+
+
+// -----------------------------------------------------------
+// The similarities of all pairs of the rows of X, i.e. X * X^T, computed like in GEMM.
+// The columns (i.e. the rows of X) are taken in blocks, which are packed so that for each k
+// the kNR values are next to each other - such a block stays in the cache, while the rows
+// of X go through it. The tile of MR x kNR results is kept in the registers for the whole
+// loop over k, so each loaded value is used MR (or kNR) times.
+// Each result is summed in the same order as by std::inner_product, with the multiply and
+// the add (no FMA) - so the results are exactly the same as of the simple double loop.
+// Examples:
+//
+//		TDenseMatrix< double >	theSims( x.rows(), x.rows() );
+//		gram_upper( x, theSims );		// theSims( r, c ) for c > r
+//
+//		gram_upper( x, theSims, SimilarityPool() );		// the same, by all cores
+//		auto [ r, c, val ] = argmax_upper( theSims, SimilarityPool() );
+//
+
+
+
+
+// The width of the packed block, i.e. the number of columns of one tile - one AVX-512 register of doubles
+inline constexpr std::size_t	kNR { 8 };
+
+// The bytes of the packed columns to keep in the cache (about a half of L2)
+inline constexpr std::size_t	kPanelBytes { 256 * 1024 };
+
+// The micro kernel - computes the tile of MR x kNR results: tile[ i * kNR + j ] = a[ i ] . (column j of the panel)
+using MicroKernel = void ( * )( const double * const * a, const double * panel, std::size_t d, double * tile );
+
+// The number of rows of the tile of the kernel of each level
+constexpr std::size_t MR_of( ESimdLevel level ) { return level == ESimdLevel::kAVX512 ? 8 : 4; }
+
+
+
+template < std::size_t MR >
+inline void Micro_Scalar( const double * const * a, const double * panel, std::size_t d, double * tile )
+{
+	double acc[ MR ][ kNR ] {};
+	for( std::size_t k {}; k < d; ++ k, panel += kNR )
+		for( std::size_t i {}; i < MR; ++ i )
+		{
+			const double ak { a[ i ][ k ] };
+			for( std::size_t j {}; j < kNR; ++ j )
+				acc[ i ][ j ] = acc[ i ][ j ] + ak * panel[ j ];
+		}
+
+	std::copy( & acc[ 0 ][ 0 ], & acc[ 0 ][ 0 ] + MR * kNR, tile );
+}
+
+#if defined( SIMD_X86 )
+
+// 4 x 8 - the 8 accumulators, the 2 columns and the broadcast take 11 of the 16 registers
+SIMD_TARGET_AVX2
+inline void Micro_AVX2( const double * const * a, const double * panel, std::size_t d, double * tile )
+{
+	__m256d acc[ 4 ][ 2 ] {};		// all zeros
+
+	for( std::size_t k {}; k < d; ++ k, panel += kNR )
+	{
+		const __m256d	b0 { _mm256_load_pd( panel ) };
+		const __m256d	b1 { _mm256_load_pd( panel + 4 ) };
+		for( std::size_t i {}; i < 4; ++ i )
+		{
+			const __m256d	ak { _mm256_broadcast_sd( a[ i ] + k ) };
+			acc[ i ][ 0 ] = _mm256_add_pd( acc[ i ][ 0 ], _mm256_mul_pd( ak, b0 ) );
+			acc[ i ][ 1 ] = _mm256_add_pd( acc[ i ][ 1 ], _mm256_mul_pd( ak, b1 ) );
+		}
+	}
+
+	for( std::size_t i {}; i < 4; ++ i )
+	{
+		_mm256_storeu_pd( tile + i * kNR, acc[ i ][ 0 ] );
+		_mm256_storeu_pd( tile + i * kNR + 4, acc[ i ][ 1 ] );
+	}
+}
+
+// 8 x 8 - the 8 accumulators, the column and the broadcast take 10 of the 32 registers
+SIMD_TARGET_AVX512
+inline void Micro_AVX512( const double * const * a, const double * panel, std::size_t d, double * tile )
+{
+	constexpr int	kRound { _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC };
+
+	__m512d acc[ 8 ] {};
+
+	for( std::size_t k {}; k < d; ++ k, panel += kNR )
+	{
+		const __m512d	b { _mm512_load_pd( panel ) };
+		for( std::size_t i {}; i < 8; ++ i )		// with the rounding given - otherwise GCC fuses them into FMA (AVX-512F has it)
+			acc[ i ] = _mm512_add_round_pd( acc[ i ], _mm512_mul_round_pd( _mm512_set1_pd( a[ i ][ k ] ), b, kRound ), kRound );
+	}
+
+	for( std::size_t i {}; i < 8; ++ i )
+		_mm512_storeu_pd( tile + i * kNR, acc[ i ] );
+}
+
+#endif
+
+inline MicroKernel MicroKernel_of( ESimdLevel level )
+{
+#if defined( SIMD_X86 )
+	if( level == ESimdLevel::kAVX512 )
+		return Micro_AVX512;
+	if( level == ESimdLevel::kAVX2 )
+		return Micro_AVX2;
+#endif
+	return level == ESimdLevel::kAVX512 ? Micro_Scalar< MR_of( ESimdLevel::kAVX512 ) > : Micro_Scalar< MR_of( ESimdLevel::kAVX2 ) >;
+}
+
+
+
+// Packs the columns [ c0, c0 + kNR ) of X^T (i.e. the rows of x) - panel[ k * kNR + j ] = x( c0 + j, k ).
+// The columns past the end of x are zeros.
+inline void PackPanel( const TDenseMatrix< double > & x, std::size_t c0, double * panel )
+{
+	const std::size_t	d { x.cols() };
+	for( std::size_t j {}; j < kNR; ++ j )
+	{
+		if( c0 + j < x.rows() )
+		{
+			const auto	v { x.row( c0 + j ) };
+			for( std::size_t k {}; k < d; ++ k )
+				panel[ k * kNR + j ] = v[ k ];
+		}
+		else
+		{
+			for( std::size_t k {}; k < d; ++ k )
+				panel[ k * kNR + j ] = 0.0;
+		}
+	}
+}
+
+// The number of columns packed at once - as many kNR panels as fit in kPanelBytes
+inline std::size_t BlockCols( std::size_t d )
+{
+	return std::max( kNR, kPanelBytes / ( sizeof( double ) * kNR * std::max< std::size_t >( d, 1 ) ) * kNR );
+}
+
+// Computes the tiles of the rows [ r_begin, r_end ) against the packed block of the columns [ c0, c0 + cols ),
+// and passes the results above the diagonal to store( r, c, val )
+template < typename Store >
+inline void GramBlock( const TDenseMatrix< double > & x, const double * block, std::size_t c0, std::size_t cols,
+							std::size_t r_begin, std::size_t r_end, MicroKernel kernel, std::size_t mr, Store && store )
+{
+	const std::size_t	n { x.rows() }, d { x.cols() };
+
+	const double *	a[ MR_of( ESimdLevel::kAVX512 ) ] {};
+	double			tile[ MR_of( ESimdLevel::kAVX512 ) * kNR ];
+
+	for( std::size_t r0 { r_begin }; r0 < r_end; r0 += mr )
+	{
+		for( std::size_t i {}; i < mr; ++ i )
+			a[ i ] = x.row( std::min( r0 + i, n - 1 ) ).data();		// the rows past the end are repeated - their results are dropped
+
+		for( std::size_t p {}; p < cols; p += kNR )
+		{
+			const std::size_t	cp { c0 + p };
+			if( cp + kNR <= r0 + 1 )
+				continue;		// the whole tile is on or below the diagonal
+
+			kernel( a, block + p * d, d, tile );
+
+			for( std::size_t i {}; i < mr && r0 + i < r_end; ++ i )
+				for( std::size_t j { cp > r0 + i ? 0 : r0 + i + 1 - cp }; j < kNR && cp + j < c0 + cols; ++ j )
+					store( r0 + i, cp + j, tile[ i * kNR + j ] );
+		}
+	}
+}
+
+
+
+inline auto StoreTo( TDenseMatrix< double > & out )
+{
+	return [ & out ]( std::size_t r, std::size_t c, double val ) { out( r, c ) = val; };
+}
+
+// Computes out( r, c ) = x.row( r ) . x.row( c ) for all c > r (the rest of out is not touched).
+// out must be x.rows() x x.rows(). The kernels of level are used - it must be supported by this CPU.
+export inline void gram_upper( const TDenseMatrix< double > & x, TDenseMatrix< double > & out, ESimdLevel level = SimdLevel() )
+{
+	const std::size_t	n { x.rows() }, d { x.cols() };
+	assert( out.rows() == n && out.cols() == n );
+	if( n < 2 )
+		return;
+
+	const MicroKernel		kernel { MicroKernel_of( level ) };
+	const std::size_t		mr { MR_of( level ) };
+	const std::size_t		kBlockCols { BlockCols( d ) };
+
+	std::vector< double, TAlignedAllocator< double, 64 > >	theBlock( kBlockCols * d );		// the packed columns
+
+	for( std::size_t c0 {}; c0 < n; c0 += kBlockCols )
+	{
+		const std::size_t	cols { std::min( kBlockCols, n - c0 ) };
+		for( std::size_t p {}; p < cols; p += kNR )
+			PackPanel( x, c0 + p, theBlock.data() + p * d );
+
+		GramBlock( x, theBlock.data(), c0, cols, 0, std::min( n, c0 + cols ) - 1, kernel, mr, StoreTo( out ) );		// only the rows above the last column
+	}
+}
+
+
+
+
+// -----------------------------------------------------------
+// The same on many threads of the pool. The columns are packed in the blocks of BlockCols( d ), as above,
+// and the rows of each block are cut into the ranges of a multiple of MR rows - each range is a task. The ranges
+// are short enough to give at least kTasksPerThread tasks to each thread in each block (so also when there is
+// only one block, e.g. of 1360 columns at D = 24, or when the blocks are run one by one as in nearest()),
+// and they are spread evenly by stealing.
+// The results are exactly the same as on one thread, since each one is computed the same way.
+// These must not be called from a task of the pool (they wait for its tasks).
+
+
+// The pool of the similarities - one thread per core, made at the first call
+export inline TWorkStealingPool & SimilarityPool()
+{
+	static TWorkStealingPool	thePool;
+	return thePool;
+}
+
+// Runs fun( i ) for i in [ 0, n ) on the pool, and waits until all are done
+template < typename Fun >
+inline void ParallelFor( TWorkStealingPool & pool, std::size_t n, const Fun & fun )
+{
+	std::latch	theDone( static_cast< std::ptrdiff_t >( n ) );
+	for( std::size_t i {}; i < n; ++ i )
+		pool.submit( [ & fun, & theDone, i ] { fun( i ); theDone.count_down(); } );
+	theDone.wait();
+}
+
+
+// The number of tasks per thread of the pool - more than one, so the faster threads can take the work of the slower ones
+inline constexpr std::size_t	kTasksPerThread { 4 };
+
+// The packed X^T and the tiles of the upper triangle - the work of the parallel gram_upper, scan_upper and nearest.
+// The tile is a range of up to RowsPerTile( cb ) rows against the block cb of the columns.
+class TUpperTiles
+{
+
+public:
+
+	// x is packed here - by the tasks of pool
+	TUpperTiles( const TDenseMatrix< double > & x, TWorkStealingPool & pool, ESimdLevel level )
+		: fX( x ), fKernel( MicroKernel_of( level ) ), fMR( MR_of( level ) ), fBlockCols( BlockCols( x.cols() ) ), fMinTiles( kTasksPerThread * pool.size() )
+	{
+		const std::size_t	n { x.rows() }, d { x.cols() };
+		const std::size_t	kBlocks { ( n + fBlockCols - 1 ) / fBlockCols };
+
+		// All of X^T is packed first (it takes as much memory as x), each block by one task
+		fPacked.resize( kBlocks * fBlockCols * d );
+		ParallelFor( pool, kBlocks, [ & ]( std::size_t b )
+		{
+			for( std::size_t c { b * fBlockCols }; c < std::min( n, ( b + 1 ) * fBlockCols ); c += kNR )
+				PackPanel( x, c, fPacked.data() + c * d );
+		} );
+
+		// The tiles are numbered block by block - only the first one of each block is kept, not all of them
+		fFirstTile.reserve( kBlocks + 1 );
+		fFirstTile.push_back( 0 );
+		for( std::size_t cb {}; cb < kBlocks; ++ cb )
+			fFirstTile.push_back( fFirstTile.back() + ( RowsOf( cb ) + RowsPerTile( cb ) - 1 ) / RowsPerTile( cb ) );
+	}
+
+	TUpperTiles & operator = ( TUpperTiles && ) = delete;
+
+public:
+
+	std::size_t size() const { return fFirstTile.back(); }
+
+	// The number of the blocks of the columns
+	std::size_t blocks() const { return fFirstTile.size() - 1; }
+
+	std::size_t block_cols() const { return fBlockCols; }
+
+	// The tiles of the block cb are [ first_tile( cb ), first_tile( cb + 1 ) ) - they have different rows
+	std::size_t first_tile( std::size_t cb ) const { return fFirstTile[ cb ]; }
+
+	// Computes the t-th tile, passing its results above the diagonal to store( r, c, val )
+	template < typename Store >
+	void compute( std::size_t t, Store && store ) const
+	{
+		assert( t < size() );
+
+		// The block of the tile t, and its first row
+		const std::size_t	cb { static_cast< std::size_t >( std::ranges::upper_bound( fFirstTile, t ) - fFirstTile.begin() ) - 1 };
+		const std::size_t	r_begin { ( t - fFirstTile[ cb ] ) * RowsPerTile( cb ) };
+		Compute( cb, r_begin, std::min( r_begin + RowsPerTile( cb ), RowsOf( cb ) ), std::forward< Store >( store ) );
+	}
+
+private:
+
+	// The number of the rows which have some columns of the block cb above the diagonal - all rows above its last column
+	std::size_t RowsOf( std::size_t cb ) const { return std::min( fX.rows(), ( cb + 1 ) * fBlockCols ) - 1; }
+
+	// As many rows per tile as give at least fMinTiles tiles of the block cb - a multiple of MR, but not more than a block
+	std::size_t RowsPerTile( std::size_t cb ) const
+	{
+		return std::clamp( RowsOf( cb ) / fMinTiles / fMR * fMR, fMR, std::max( fMR, fBlockCols / fMR * fMR ) );
+	}
+
+	// The rows [ r_begin, r_end ) against the columns of the block cb
+	template < typename Store >
+	void Compute( std::size_t cb, std::size_t r_begin, std::size_t r_end, Store && store ) const
+	{
+		const std::size_t	n { fX.rows() }, d { fX.cols() };
+		const std::size_t	c0 { cb * fBlockCols }, cols { std::min( fBlockCols, n - c0 ) };
+		if( r_begin < r_end )
+			GramBlock( fX, fPacked.data() + c0 * d, c0, cols, r_begin, r_end, fKernel, fMR, std::forward< Store >( store ) );
+	}
+
+private:
+
+	const TDenseMatrix< double > &		fX;
+
+	MicroKernel			fKernel;
+	std::size_t			fMR;
+	std::size_t			fBlockCols;
+	std::size_t			fMinTiles;		// per block
+
+	std::vector< double, TAlignedAllocator< double, 64 > >		fPacked;
+
+	// The number of the tiles before each block of the columns, and of all of them at the end - O( N / BlockCols ), not one per tile
+	std::vector< std::size_t >		fFirstTile;
+
+};
+
+
+export inline void gram_upper( const TDenseMatrix< double > & x, TDenseMatrix< double > & out, TWorkStealingPool & pool, ESimdLevel level = SimdLevel() )
+{
+	const std::size_t	n { x.rows() };
+	if( n < 2 || pool.size() < 2 )
+		return gram_upper( x, out, level );		// nothing to share
+
+	assert( out.rows() == n && out.cols() == n );
+
+	const TUpperTiles	theTiles( x, pool, level );
+	ParallelFor( pool, theTiles.size(), [ & ]( std::size_t t ) { theTiles.compute( t, StoreTo( out ) ); } );
+}
+
+
+
+
+// -----------------------------------------------------------
+// The maximum of the upper triangle (above the diagonal)
+
+
+export struct TPairSim
+{
+	std::size_t		fRow {};
+	std::size_t		fCol {};
+	double			fVal { std::numeric_limits< double >::lowest() };		// lowest - none found
+};
+
+// The order of the results: the greater value first, and of the equal ones the pair with the smaller ( row, col ).
+// This is the first maximum of the row by row scan - and it does not depend on how the scan is split among the threads.
+export constexpr bool is_better( const TPairSim & a, const TPairSim & b )
+{
+	if( a.fVal != b.fVal )
+		return a.fVal > b.fVal;
+	return std::tie( a.fRow, a.fCol ) < std::tie( b.fRow, b.fCol );
+}
+
+inline TPairSim ArgMaxRows( const TDenseMatrix< double > & m, std::size_t r_begin, std::size_t r_end )
+{
+	TPairSim	theBest;
+	for( std::size_t r { r_begin }; r < r_end; ++ r )
+	{
+		const auto	row { m.row( r ) };
+		for( std::size_t c { r + 1 }; c < row.size(); ++ c )
+			if( theBest.fVal < row[ c ] )		// only the greater - so the first of the equal ones stays
+				theBest = { r, c, row[ c ] };
+	}
+	return theBest;
+}
+
+// Splits the rows [ 0, n ) of the upper triangle into at most parts ranges [ bounds[ i ], bounds[ i + 1 ] )
+// with about the same number of elements - the row r has n - 1 - r of them, so the first ranges have less rows
+inline std::vector< std::size_t > TriangleRowSplit( std::size_t n, std::size_t parts )
+{
+	const std::size_t	kTotal { n * ( n - 1 ) / 2 };
+
+	std::vector< std::size_t >	bounds { 0 };
+	std::size_t	sum {};
+	for( std::size_t r {}; r + 1 < n && bounds.size() < parts; ++ r )
+		if( ( sum += n - 1 - r ) * parts >= kTotal * bounds.size() )
+			bounds.push_back( r + 1 );
+	if( bounds.back() != n )
+		bounds.push_back( n );
+	return bounds;
+}
+
+// m must be square
+export inline TPairSim argmax_upper( const TDenseMatrix< double > & m )
+{
+	assert( m.rows() == m.cols() );
+	return ArgMaxRows( m, 0, m.rows() );
+}
+
+export inline TPairSim argmax_upper( const TDenseMatrix< double > & m, TWorkStealingPool & pool )
+{
+	assert( m.rows() == m.cols() );
+
+	constexpr std::size_t	kMinRows { 256 };		// below - not worth the tasks
+	if( m.rows() < kMinRows || pool.size() < 2 )
+		return argmax_upper( m );
+
+	const auto	theBounds { TriangleRowSplit( m.rows(), 4 * pool.size() ) };		// a few parts per thread, to even them out
+
+	std::vector< TPairSim >	theBest( theBounds.size() - 1 );
+	ParallelFor( pool, theBest.size(), [ & ]( std::size_t i ) { theBest[ i ] = ArgMaxRows( m, theBounds[ i ], theBounds[ i + 1 ] ); } );
+
+	return std::ranges::min( theBest, []( const auto & a, const auto & b ) { return is_better( a, b ); } );
+}
+
+
+
+
+// -----------------------------------------------------------
+// The fused comp_distance + find_max. The similarities are computed tile by tile, as above, but
+// each one goes straight to a sink, which keeps only what we need (e.g. the maximum) - so there
+// is no N x N matrix, and the memory is O( N D ) of the packed X^T, rather than O( N^2 ).
+// A sink is called as sink( r, c, val ) for each c > r (in no particular order), and sink.merge( other )
+// adds the results of another one. Each part of the tiles has its own copy of the sink, so there are
+// no locks - the copies are merged at the end, in the same order each time.
+// Examples:
+//
+//		auto [ r, c, val ] = max_pair( x, SimilarityPool() );
+//		for( auto [ r, c, val ] : top_pairs( x, 10, SimilarityPool() ) )
+//			...
+//
+
+
+export template < typename Sink >
+concept PairSink = std::copy_constructible< Sink >
+						&& std::invocable< Sink &, std::size_t, std::size_t, double >
+						&& requires( Sink a, Sink b ) { a.merge( std::move( b ) ); };
+
+// Passes all the similarities x.row( r ) . x.row( c ), c > r, to the copies of proto, and returns them merged
+export template < PairSink Sink >
+Sink scan_upper( const TDenseMatrix< double > & x, const Sink & proto, TWorkStealingPool & pool, ESimdLevel level = SimdLevel() )
+{
+	if( x.rows() < 2 )
+		return proto;
+
+	const TUpperTiles	theTiles( x, pool, level );
+
+	// A few contiguous parts of the tiles per thread - each with its own sink
+	const std::size_t	kParts { std::min( theTiles.size(), kTasksPerThread * pool.size() ) };
+
+	std::vector< Sink >	theSinks( kParts, proto );
+	ParallelFor( pool, kParts, [ & ]( std::size_t i )
+	{
+		for( std::size_t t { i * theTiles.size() / kParts }; t < ( i + 1 ) * theTiles.size() / kParts; ++ t )
+			theTiles.compute( t, theSinks[ i ] );
+	} );
+
+	Sink	theResult { std::move( theSinks.front() ) };
+	for( std::size_t i { 1 }; i < kParts; ++ i )
+		theResult.merge( std::move( theSinks[ i ] ) );
+	return theResult;
+}
+
+
+
+// Keeps the best pair (see is_better)
+export struct TMaxPairSink
+{
+	TPairSim	fBest;
+
+	void operator () ( std::size_t r, std::size_t c, double val )
+	{
+		if( val >= fBest.fVal && is_better( { r, c, val }, fBest ) )		// almost always only the first test
+			fBest = { r, c, val };
+	}
+
+	void merge( TMaxPairSink && other )
+	{
+		if( is_better( other.fBest, fBest ) )
+			fBest = other.fBest;
+	}
+};
+
+// Keeps the k best pairs - in the heap, with the worst of them at the top
+export class TTopPairsSink
+{
+
+public:
+
+	explicit TTopPairsSink( std::size_t k ) : fK( k )
+	{
+		assert( fK > 0 );
+		fHeap.reserve( fK );
+	}
+
+	void operator () ( std::size_t r, std::size_t c, double val )
+	{
+		if( fHeap.size() < fK || val >= fHeap.front().fVal )
+			Push( { r, c, val } );
+	}
+
+	void merge( TTopPairsSink && other )
+	{
+		for( const auto & p : other.fHeap )
+			Push( p );
+	}
+
+	// The pairs from the best one
+	std::vector< TPairSim > sorted() &&
+	{
+		std::ranges::sort( fHeap, is_better );
+		return std::move( fHeap );
+	}
+
+private:
+
+	void Push( const TPairSim & p )
+	{
+		if( fHeap.size() < fK )
+		{
+			fHeap.push_back( p );
+			std::ranges::push_heap( fHeap, is_better );
+		}
+		else if( is_better( p, fHeap.front() ) )
+		{
+			std::ranges::pop_heap( fHeap, is_better );
+			fHeap.back() = p;
+			std::ranges::push_heap( fHeap, is_better );
+		}
+	}
+
+private:
+
+	std::size_t					fK {};
+
+	std::vector< TPairSim >		fHeap;
+
+};
+
+
+
+// The most similar pair of the rows of x - the same as argmax_upper of gram_upper, with no N x N matrix.
+// Its fVal is lowest if x has less than 2 rows.
+export inline TPairSim max_pair( const TDenseMatrix< double > & x, TWorkStealingPool & pool, ESimdLevel level = SimdLevel() )
+{
+	return scan_upper( x, TMaxPairSink {}, pool, level ).fBest;
+}
+
+// The k most similar pairs of the rows of x, from the best one (less if there are not so many)
+export inline std::vector< TPairSim > top_pairs( const TDenseMatrix< double > & x, std::size_t k, TWorkStealingPool & pool, ESimdLevel level = SimdLevel() )
+{
+	if( k == 0 )
+		return {};
+	return scan_upper( x, TTopPairsSink( k ), pool, level ).sorted();
+}
+
+
+
+
+// -----------------------------------------------------------
+// The k nearest neighbours of each row, and the k most similar pairs, in one pass.
+// The neighbours of the row r are kept in the bounded heap of r, so the heaps take O( N k ). Each tile
+// of the upper triangle is computed once. The column blocks go one after another, each split into its tiles as
+// in gram_upper - the tiles of one block have different rows, so each task puts the neighbours c > r
+// straight into the heaps of its rows, with no locks. The neighbours r < c go to the heaps of the columns of
+// that task, which are merged into the heaps of the columns after the block, column by column in the order
+// of the tasks - so the result does not depend on the threads (is_nearer is a total order anyway).
+// Examples:
+//
+//		const auto theNearest = nearest( x, 10, 5, SimilarityPool() );		// 10 pairs and 5 neighbours of each row
+//		for( auto [ idx, val ] : theNearest.neighbours( r ) )
+//			...
+//
+
+
+export struct TNeighbour
+{
+	std::size_t		fIdx {};
+	double			fVal { std::numeric_limits< double >::lowest() };
+};
+
+// The greater value first, and of the equal ones the smaller index - as for is_better, it does not depend on the threads
+export constexpr bool is_nearer( const TNeighbour & a, const TNeighbour & b )
+{
+	if( a.fVal != b.fVal )
+		return a.fVal > b.fVal;
+	return a.fIdx < b.fIdx;
+}
+
+export struct TNearest
+{
+	std::vector< TPairSim >			fTopPairs;		// the most similar pairs, from the best one
+
+	std::size_t							fK {};			// the number of the neighbours of each row (less than asked if there are not so many rows)
+	std::vector< TNeighbour >		fNeighbours;	// fK per row, from the nearest one
+
+	std::span< const TNeighbour > neighbours( std::size_t r ) const
+	{
+		assert( ( r + 1 ) * fK <= fNeighbours.size() );
+		return { fNeighbours.data() + r * fK, fK };
+	}
+};
+
+
+// The bounded heaps of all rows in one block of memory - the worst kept neighbour at the top of each
+class TNeighbourHeaps
+{
+
+public:
+
+	TNeighbourHeaps( std::size_t n, std::size_t k ) : fK( k ), fSizes( n ), fHeaps( n * k ) { assert( fK > 0 ); }
+
+	void push( std::size_t r, const TNeighbour & nb )
+	{
+		TNeighbour * const	h { fHeaps.data() + r * fK };
+		auto &					size { fSizes[ r ] };
+
+		if( size < fK )
+		{
+			h[ size ++ ] = nb;
+			std::push_heap( h, h + size, is_nearer );
+		}
+		else if( is_nearer( nb, h[ 0 ] ) )
+		{
+			std::pop_heap( h, h + fK, is_nearer );
+			h[ fK - 1 ] = nb;
+			std::push_heap( h, h + fK, is_nearer );
+		}
+	}
+
+	// The kept neighbours of the row r, in the heap order
+	std::span< const TNeighbour > row( std::size_t r ) const { return { fHeaps.data() + r * fK, fSizes[ r ] }; }
+
+	// The neighbours of each row from the nearest one (all rows must be full)
+	std::vector< TNeighbour > sorted() &&
+	{
+		for( std::size_t r {}; r < fSizes.size(); ++ r )
+		{
+			assert( fSizes[ r ] == fK );
+			std::sort( fHeaps.data() + r * fK, fHeaps.data() + ( r + 1 ) * fK, is_nearer );
+		}
+		return std::move( fHeaps );
+	}
+
+private:
+
+	std::size_t						fK {};
+
+	std::vector< std::size_t >	fSizes;
+	std::vector< TNeighbour >		fHeaps;
+
+};
+
+
+// The k_pairs most similar pairs and the k_nn nearest neighbours of each row of x (either can be 0)
+export inline TNearest nearest( const TDenseMatrix< double > & x, std::size_t k_pairs, std::size_t k_nn, TWorkStealingPool & pool, ESimdLevel level = SimdLevel() )
+{
+	const std::size_t	n { x.rows() };
+
+	TNearest	theResult;
+	theResult.fK = n > 1 ? std::min( k_nn, n - 1 ) : 0;
+
+	if( theResult.fK == 0 )
+	{
+		theResult.fTopPairs = top_pairs( x, k_pairs, pool, level );		// only the pairs - each tile once
+		return theResult;
+	}
+
+	const TUpperTiles	theTiles( x, pool, level );
+	const std::size_t	kBlockCols { theTiles.block_cols() };
+
+	TNeighbourHeaps		theHeaps( n, theResult.fK );
+	TTopPairsSink			theTopPairs( std::max< std::size_t >( k_pairs, 1 ) );
+
+	// Of the tasks of one column block - reused by the next blocks
+	std::vector< TNeighbourHeaps >	theColHeaps;
+	std::vector< TTopPairsSink >		theSinks;
+
+	for( std::size_t cb {}; cb < theTiles.blocks(); ++ cb )
+	{
+		const std::size_t	t_begin { theTiles.first_tile( cb ) }, kTasks { theTiles.first_tile( cb + 1 ) - t_begin };
+		const std::size_t	c_begin { cb * kBlockCols }, cols { std::min( kBlockCols, n - c_begin ) };
+
+		theColHeaps.assign( kTasks, TNeighbourHeaps( cols, theResult.fK ) );
+		if( k_pairs > 0 )
+			theSinks.assign( kTasks, TTopPairsSink( k_pairs ) );
+
+		ParallelFor( pool, kTasks, [ & ]( std::size_t i )
+		{
+			theTiles.compute( t_begin + i, [ & ]( std::size_t r, std::size_t c, double val )
+			{
+				theHeaps.push( r, { c, val } );		// the row r is only in this tile of the block
+				theColHeaps[ i ].push( c - c_begin, { r, val } );
+				if( k_pairs > 0 )
+					theSinks[ i ]( r, c, val );
+			} );
+		} );
+
+		// Each column from the heaps of all tasks, in their order
+		const std::size_t	kParts { std::min( cols, kTasksPerThread * pool.size() ) };
+		ParallelFor( pool, kParts, [ & ]( std::size_t i )
+		{
+			for( std::size_t c { i * cols / kParts }; c < ( i + 1 ) * cols / kParts; ++ c )
+				for( const auto & h : theColHeaps )
+					for( const auto & nb : h.row( c ) )
+						theHeaps.push( c_begin + c, nb );
+		} );
+
+		if( k_pairs > 0 )
+			for( auto & sink : theSinks )
+				theTopPairs.merge( std::move( sink ) );
+	}
+
+	if( k_pairs > 0 )
+		theResult.fTopPairs = std::move( theTopPairs ).sorted();
+
+	theResult.fNeighbours = std::move( theHeaps ).sorted();
+	return theResult;
+}
+
+
+
+
@@ -27,51 +27,20 @@
 
 #include <random>
 #include <print>
+#include <chrono>
+#include <memory_resource>
+#include <limits>
 
 
 import payload;
+import pipe_stage;
+import serial_pipe;
 
 
 
 // ===================================================================
-// Version of the pipe-line with std::expected
+// Version of the pipe-line with std::expected - the operators | and compose() are in the serial_pipe module
 
-template < typename T >
-concept is_expected = requires( T t )
-{
-	typename T::value_type;		// type requirement  nested member name exists
-	typename T::error_type;		// type requirement  nested member name exists
-
-	requires std::is_constructible_v< bool, T >;		// std::convertible_to< T, bool > will not work - ok, there is a conversion but this is a CONTEXTUAL CONVERSION!
-	requires std::same_as< decltype( * t ), typename T::value_type & >;
-	requires std::same_as< std::remove_cvref_t< decltype( * t ) >, typename T::value_type >;
-
-	requires std::constructible_from< T, std::unexpected< typename T::error_type > >; 
-};
-
-
-#if 0
-// In this version if there is an error in the pipeline, then the further functions in the chaing are NOT called at all
-template < typename T, typename E, typename Function >
-requires std::invocable< Function, std::expected< T, E > >
-			&& is_expected< typename std::invoke_result_t< Function, std::expected< T, E > > >
-constexpr auto operator | ( std::expected< T, E > && ex, Function && f ) -> typename std::invoke_result_t< Function, std::expected< T, E > >
-{
-	return ex ? std::invoke( std::forward< Function >( f ), * std::forward< std::expected< T, E > >( ex ) ) : ex;
-}
-
-#else
-
-// The second, more general version allows passing in and out std::expected with possibly different types
-// In this version all functions in the pipe are called and there is their responsibility to check if the passed object has and object or an error
-template < typename InT, typename InE, typename Function >
-requires std::invocable< Function, std::expected< InT, InE > >
-			&& is_expected< typename std::invoke_result_t< Function, std::expected< InT, InE > > >
-constexpr auto operator | ( std::expected< InT, InE > && ex, Function && f ) -> typename std::invoke_result_t< Function, std::expected< InT, InE > >
-{
-	return std::invoke( std::forward< Function >( f ), /***/ std::forward< std::expected< InT, InE > >( ex ) );
-}
-#endif 
 
 
 PayloadOrError Payload_Proc_1( PayloadOrError && s )
@@ -94,8 +63,9 @@ PayloadOrError Payload_Proc_2( PayloadOrError && s )
 
 	// Emulate the error, at least once in a while ...
 	std::mt19937 rand_gen( std::random_device {} () );
-	return ( rand_gen() % 2 ) ? s : 
-					std::unexpected { rand_gen() % 2 ? OpErrorType::kOverflow : OpErrorType::kUnderflow };
+	if( rand_gen() % 2 )
+		return std::unexpected { rand_gen() % 2 ? OpErrorType::kOverflow : OpErrorType::kUnderflow };
+	return s;		// not in ?: - there s would be copied
 }
 
 PayloadOrError Payload_Proc_3( PayloadOrError && s )
@@ -137,6 +107,50 @@ void Payload_PipeTest()
 }
 
 
+// The stages of the short-circuit mode - they take the value, so they do not check for the error,
+// and are not called at all after one
+PayloadOrError Payload_Step_1( Payload && s )
+{
+	++ s.fVal;
+	s.fStr += " step 1,";
+	return std::move( s );
+}
+
+PayloadOrError Payload_Step_2( Payload && s )
+{
+	++ s.fVal;
+	s.fStr += " step 2,";
+	if( s.fVal % 2 == 0 )
+		return std::unexpected { OpErrorType::kOverflow };		// now deterministic, to see which input fails
+	return std::move( s );
+}
+
+// Changes the type - returns the length of the string
+std::expected< std::size_t, OpErrorType > Payload_Step_3( Payload && s )
+{
+	return s.fStr.size();
+}
+
+
+// Here the stages after the failed one are skipped
+void Payload_PipeTest_ShortCircuit()
+{
+	for( const int start : { 42, 43 } )		// 42 fails in Payload_Step_2
+	{
+		auto res = PayloadOrError { Payload { "Start string ", start } } | Payload_Step_1 | Payload_Step_2 | Payload_Step_3;
+
+		if( res )
+			print_nl( "Success! Length of the string: ", * res );
+		else
+			print_nl( "Error: ", static_cast< int >( res.error() ) );
+	}
+
+	// The error at the input - none of the stages is called
+	auto res = PayloadOrError { std::unexpected( OpErrorType::kInvalidInput ) } | Payload_Step_1 | Payload_Step_2 | Payload_Step_3;
+	print_nl( "Has value: ", res.has_value() );
+}
+
+
 // This is a version of Payload_PipeTest but this time with the monadic interface of std::expected
 void Payload_PipeTest_Monadic()
 {
@@ -172,13 +186,141 @@ void Payload_PipeTest_Monadic()
 
 
 
+// The pipe is built once and then run on a few objects, one by one and as a range
+void Payload_PipeTest_Composed()
+{
+	const auto thePipe = compose( Payload_Proc_1 ) | Payload_Proc_2 | Payload_Proc_3;
+
+	for( const int start : { 1, 2, 3 } )
+		if( auto res = thePipe( PayloadOrError { Payload { "Start string ", start } } ) )
+			print_nl( "Success! Result of the pipe: fStr == ", res->fStr, " fVal == ", res->fVal );
+		else
+			print_nl( "Error: ", static_cast< int >( res.error() ) );
+
+	const std::vector< PayloadOrError >	theInputs { Payload { "a", 10 }, std::unexpected( OpErrorType::kInvalidInput ), Payload { "b", 20 } };
 
+	for( auto && res : theInputs | thePipe )		// theInputs are copied into the pipe, so they are left untouched
+		print_nl( "Has value: ", res.has_value() );
+}
 
 
 
+// ===================================================================
+// The compile-time pipes.
+// The operator | is constexpr, so if the stages are constexpr as well, and the objects are of the literal
+// types, then the whole pipe is computed by the compiler when its input is a literal. Payload cannot be used
+// here (its string is allocated at run time), but SmallPayload keeps its string inside and can.
 
 
+// The stages of the short-circuit mode (as Payload_Step_1..3)
+constexpr SmallPayloadOrError Const_Step_1( SmallPayload && s )
+{
+	++ s.fVal;
+	if( not s.fStr.append( "_1" ) )
+		return std::unexpected { OpErrorType::kOverflow };		// the string does not fit
+	return std::move( s );
+}
 
+constexpr SmallPayloadOrError Const_Step_2( SmallPayload && s )
+{
+	if( s.fVal > std::numeric_limits< int >::max() / 2 )
+		return std::unexpected { OpErrorType::kOverflow };
+	s.fVal *= 2;
+	if( not s.fStr.append( "_2" ) )
+		return std::unexpected { OpErrorType::kOverflow };
+	return std::move( s );
+}
+
+// Changes the type - returns the value plus the length of the string
+constexpr std::expected< int, OpErrorType > Const_Step_3( SmallPayload && s )
+{
+	return s.fVal + static_cast< int >( s.fStr.size() );
+}
+
+static_assert( ( SmallPayloadOrError { SmallPayload { "c", 1 } } | Const_Step_1 | Const_Step_2 | Const_Step_3 ).value() == 9 );		// ( 1 + 1 ) * 2 + "c_1_2"
+static_assert( ( SmallPayloadOrError { SmallPayload { "c", std::numeric_limits< int >::max() / 2 } } | Const_Step_1 | Const_Step_2 | Const_Step_3 ).error() == OpErrorType::kOverflow );
+
+
+// The lookup table - each entry is the result of the pipe for its index (or kNoEntry if it failed)
+template < std::size_t N >
+constexpr auto MakePipeTable()
+{
+	constexpr int	kNoEntry { -1 };
+
+	std::array< int, N >	table {};
+	for( auto i : CppBook::range( N ) )
+	{
+		auto res = SmallPayloadOrError { SmallPayload { "", static_cast< int >( i ) } } | Const_Step_1 | Const_Step_2 | Const_Step_3;
+		table[ i ] = res ? * res : kNoEntry;
+	}
+	return table;
+}
+
+constexpr auto kPipeTable = MakePipeTable< 64 >();		// no code is run at the start-up
+
+// The same with the composed pipe
+constexpr auto kConstPipe = compose( Const_Step_1, Const_Step_2, Const_Step_3 );
+
+static_assert( kConstPipe( SmallPayloadOrError { SmallPayload { "c", 1 } } ).value() == 9 );
+
+static_assert( kPipeTable[ 0 ] == 6 && kPipeTable[ 63 ] == 132 );
+
+
+// sqrt for the constant evaluation (std::sqrt is not constexpr) - the Newton iterations, going down
+// from above the root, so they stop when the next one is not smaller
+constexpr double Const_Sqrt( double x )
+{
+	if( x <= 0.0 )
+		return 0.0;
+
+	double r { x > 1.0 ? x : 1.0 };
+	for( double next { 0.5 * ( r + x / r ) }; next < r; next = 0.5 * ( r + x / r ) )
+		r = next;
+	return r;
+}
+
+template < std::size_t N >
+using ConstVecOrError = std::expected< std::array< double, N >, OpErrorType >;
+
+// The same as normalize_row in the dense_matrix module, but also for the constant evaluation
+template < std::size_t N >
+constexpr ConstVecOrError< N > Const_Normalize( std::array< double, N > && v )
+{
+	double denom {};
+	for( const auto x : v )
+		denom += x * x;
+
+	if( denom < 1e-76 )
+		return std::unexpected { OpErrorType::kUnderflow };
+
+	const double sq { Const_Sqrt( denom ) };
+	for( auto & x : v )
+		x /= sq;
+	return std::move( v );
+}
+
+// The normalization constants computed at compile time
+constexpr auto kUnitVec = ( ConstVecOrError< 4 > { std::array { 1.0, 2.0, 2.0, 4.0 } } | Const_Normalize< 4 > ).value();		// the norm is 5
+
+static_assert( kUnitVec[ 0 ] == 0.2 && kUnitVec[ 3 ] == 0.8 );
+static_assert( not ( ConstVecOrError< 2 > { std::array { 0.0, 0.0 } } | Const_Normalize< 2 > ).has_value() );
+
+
+// The same pipes at run time
+void Payload_PipeTest_Constexpr()
+{
+	for( const auto i : CppBook::range( 8 ) )
+		print( kPipeTable[ i ], ", " );
+	std::cout << "\n";
+
+	for( const auto x : kUnitVec )
+		print( x, ", " );
+	std::cout << "\n";
+
+	const int	theVal { static_cast< int >( std::random_device {} () % 100 ) };		// known only at run time
+	if( auto res = SmallPayloadOrError { SmallPayload { "run", theVal } } | Const_Step_1 | Const_Step_2 | Const_Step_3 )
+		print_nl( "Success! Result of the pipe: ", * res );
+}
 
 
 
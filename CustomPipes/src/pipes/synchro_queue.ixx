@@ -0,0 +1,818 @@
+// ---------------------------------------------------
+// Created by Boguslaw Cyganek (C) 2024
+// ---------------------------------------------------
+
+
+module;
+
+#include "simd_target.h"		// for _mm_pause - the macros do not pass through import
+
+export module synchro_queue;
+
+
+
+
+import <cstddef>;
+import <cassert>;
+import <expected>;
+import <span>;
+import <algorithm>;
+import <queue>;
+import <deque>;
+import <memory_resource>;
+import <vector>;
+import <mutex>;
+import <condition_variable>;
+import <atomic>;
+import <chrono>;
+import <limits>;
+import <thread>;
+import <optional>;
+import <functional>;
+import <memory>;
+import <type_traits>;
+
+import pipe_stats;
+
+
+
+// -----------------------------------------------------------
+// Why pop did not give an element. This is out of band - no special value
+// of the element is needed to tell the consumer that the data is over.
+//	kClosed		- the end of the data (drain): all elements pushed before close() were given out
+//	kCancelled	- abort: cancel() was called and whatever was still in the queue is dropped
+
+
+export enum class EQueueErr : unsigned char { kClosed, kCancelled };
+
+
+
+
+
+// -----------------------------------------------------------
+// An element with its sequence number - used to restore the order
+// of the elements processed by many threads (see TReorderBuffer)
+
+
+export template < typename Elem >
+struct TSequenced
+{
+	std::size_t		fSeqNo {};
+	Elem				fElem {};
+};
+
+
+
+
+
+// -----------------------------------------------------------
+// The general purpose thread-safe queue.
+// Any number of threads can push and pop - access is guarded by the mutex.
+// The capacity can be limited - then push blocks while the queue is full,
+// while try_push and push_for let the producer decide what to do.
+// The blocks of the queue come from its own pool - the freed ones are reused,
+// so after the warm-up push and pop do not call malloc.
+
+
+export template < typename Elem >
+class TSynchroQueue
+{
+
+public:
+
+	using value_type = Elem;
+
+	using ExpectedElem = std::expected< Elem, EQueueErr >;
+
+	using ExpectedSequenced = std::expected< TSequenced< Elem >, EQueueErr >;
+
+public:
+
+	// The max number of elements that can be stored - the default is (practically) unbounded
+	static constexpr std::size_t	kUnbounded { std::numeric_limits< std::size_t >::max() };
+
+public:
+
+	// Blocks while the queue is full - this way a fast producer is throttled by a slow consumer
+	void push( Elem && in_elem )
+	{
+		{
+			std::unique_lock	theLock( fMutex );
+			fNotFullCondVar.wait( theLock, [ this ]() { return fQueue.size() < kCapacity || fClosed; } );
+			if( fClosed )
+			{
+				assert( fCancelled );		// pushing to the closed queue is an error, to the cancelled one - not, the element is just dropped
+				return;
+			}
+			fQueue.emplace( std::move( in_elem ) );		// in_elem is a name, i.e. an lvalue - without std::move it would be copied
+			RecordDepth();
+		}
+
+		fCondVar.notify_one();	// we call notify_one when the mutex is already released - otherwise the notified thread
+										// can be woken up only to try to lock still locked mutex
+		CallOnPush();
+	}
+
+	// Does not block - returns false if the queue is full or closed (in_elem is left untouched then)
+	bool try_push( Elem && in_elem )
+	{
+		{
+			std::unique_lock	theLock( fMutex );
+			if( fQueue.size() >= kCapacity || fClosed )
+				return false;
+			fQueue.emplace( std::move( in_elem ) );
+			RecordDepth();
+		}
+
+		fCondVar.notify_one();
+		CallOnPush();
+		return true;
+	}
+
+	// Blocks while the queue is full but no longer than timeout.
+	// Returns false if the time is out or the queue is closed (in_elem is left untouched then).
+	template < typename Rep, typename Period >
+	bool push_for( Elem && in_elem, const std::chrono::duration< Rep, Period > & timeout )
+	{
+		{
+			std::unique_lock	theLock( fMutex );
+			if( not fNotFullCondVar.wait_for( theLock, timeout, [ this ]() { return fQueue.size() < kCapacity || fClosed; } ) || fClosed )
+				return false;
+			fQueue.emplace( std::move( in_elem ) );
+			RecordDepth();
+		}
+
+		fCondVar.notify_one();
+		CallOnPush();
+		return true;
+	}
+
+	ExpectedElem pop( void )
+	{
+		std::unique_lock	theLock( fMutex );
+
+		// Block waiting until the queue is not empty
+		// std::condition_variable operates only with std::unique_lock<std::mutex>
+		// This is the key point - if I'm here then I possessed the mutex. However, if I stay here we ALL WOULD BE BLOCKED,
+		// since no other thread can push anything to this queue. The solution is to give up my thread and realease the mutex
+		// until the condition is true - in this case, this is that the queue is not longer empty (or it was closed).
+		fCondVar.wait( theLock, [ this ]() { return not fQueue.empty() || fClosed; } );
+
+		if( fQueue.empty() )
+			return ExpectedElem( std::unexpected( StopReason() ) );		// closed and drained (or cancelled) - nothing more will come
+
+		// OK, we have something to pop and to return - moved out, so the buffers of the element are not copied
+		ExpectedElem out_elem( std::move( fQueue.front() ) );
+		fQueue.pop();
+
+		theLock.unlock();
+		fNotFullCondVar.notify_one();		// there is a free place for the producer
+
+		return out_elem;
+	}
+
+	// The same as pop, but the element gets the number in the order of leaving the queue.
+	// The number is assigned under the lock, so if all consumers call pop_sequenced,
+	// then the numbers are consecutive no matter how many threads pop.
+	ExpectedSequenced pop_sequenced( void )
+	{
+		std::unique_lock	theLock( fMutex );
+
+		fCondVar.wait( theLock, [ this ]() { return not fQueue.empty() || fClosed; } );
+
+		if( fQueue.empty() )
+			return ExpectedSequenced( std::unexpected( StopReason() ) );
+
+		TSequenced< Elem >	out_elem { fPopSeqNo ++, std::move( fQueue.front() ) };
+		fQueue.pop();
+
+		theLock.unlock();
+		fNotFullCondVar.notify_one();
+
+		return ExpectedSequenced( std::move( out_elem ) );
+	}
+
+	// The batched versions - many elements are moved under one lock and with one notification.
+	// This amortizes the synchronization cost if the elements are small.
+
+	// Moves all in_elems into the queue (in_elems are left in the moved-from state).
+	// If the capacity is exceeded, then the elements are moved in chunks, as the free places appear.
+	void push_bulk( std::span< Elem > in_elems )
+	{
+		while( not in_elems.empty() )
+		{
+			{
+				std::unique_lock	theLock( fMutex );
+				fNotFullCondVar.wait( theLock, [ this ]() { return fQueue.size() < kCapacity || fClosed; } );
+
+				if( fClosed )
+				{
+					assert( fCancelled );
+					return;
+				}
+
+				const auto n = std::min( kCapacity - fQueue.size(), in_elems.size() );
+				for( auto & e : in_elems.first( n ) )
+					fQueue.emplace( std::move( e ) );
+
+				in_elems = in_elems.subspan( n );
+				RecordDepth();
+			}
+
+			fCondVar.notify_all();	// one call for the whole chunk - the consumers take as many as they want
+			CallOnPush();
+		}
+	}
+
+	// Blocks until the queue is not empty, then moves up to max_n elements to the end of out_elems.
+	// Returns the number of the elements taken - 0 only if the queue is closed and drained, or cancelled.
+	std::size_t pop_bulk( std::vector< Elem > & out_elems, std::size_t max_n )
+	{
+		assert( max_n > 0 );
+
+		std::unique_lock	theLock( fMutex );
+
+		fCondVar.wait( theLock, [ this ]() { return not fQueue.empty() || fClosed; } );
+
+		const auto n = std::min( max_n, fQueue.size() );
+		for( std::size_t i {}; i < n; ++ i )
+		{
+			out_elems.push_back( std::move( fQueue.front() ) );
+			fQueue.pop();
+		}
+
+		theLock.unlock();
+		fNotFullCondVar.notify_all();		// n places are free now
+
+		return n;
+	}
+
+	// Does not block - moves up to max_n elements to the end of out_elems.
+	// Returns the number of the elements taken (0 if the queue is empty).
+	std::size_t try_pop_bulk( std::vector< Elem > & out_elems, std::size_t max_n )
+	{
+		std::unique_lock	theLock( fMutex );
+
+		const auto n = std::min( max_n, fQueue.size() );
+		for( std::size_t i {}; i < n; ++ i )
+		{
+			out_elems.push_back( std::move( fQueue.front() ) );
+			fQueue.pop();
+		}
+
+		theLock.unlock();
+		if( n > 0 )
+			fNotFullCondVar.notify_all();
+
+		return n;
+	}
+
+	// This is not thread safe!
+	auto size() const { return fQueue.size(); }
+
+	// This one is thread safe
+	bool empty() const
+	{
+		std::unique_lock	theLock( fMutex );
+		return fQueue.empty();
+	}
+
+	auto capacity() const { return kCapacity; }
+
+	// Marks the end of the stream - nothing more can be pushed, while pop and pop_bulk
+	// first give out what is left, then return the error (or 0) instead of waiting.
+	// Thus a consumer can tell the end of the data of any type, with no special token.
+	void close()
+	{
+		{
+			std::unique_lock	theLock( fMutex );
+			fClosed = true;
+		}
+
+		fCondVar.notify_all();
+		fNotFullCondVar.notify_all();
+		CallOnPush();		// a consumer waiting for the push should also learn about it
+	}
+
+	bool is_closed() const
+	{
+		std::unique_lock	theLock( fMutex );
+		return fClosed;
+	}
+
+	// Aborts the stream - the elements still in the queue are dropped, all waiting threads
+	// are woken up, pop returns EQueueErr::kCancelled, and whatever is pushed later is ignored.
+	// Unlike close(), it can be called by anyone, e.g. by the consumer which does not want more data.
+	void cancel()
+	{
+		{
+			std::unique_lock	theLock( fMutex );
+			fCancelled = fClosed = true;
+			while( not fQueue.empty() )		// not fQueue = {} - this would make a new queue in the default memory
+				fQueue.pop();
+		}
+
+		fCondVar.notify_all();
+		fNotFullCondVar.notify_all();
+		CallOnPush();
+	}
+
+	bool is_cancelled() const
+	{
+		std::unique_lock	theLock( fMutex );
+		return fCancelled;
+	}
+
+	// Sets the function called after each push - this way a consumer that does not wait in pop
+	// (e.g. a task in a thread pool) learns that there is something to take.
+	// It can be set only once, but this can be done while other threads already push.
+	void set_on_push( std::function< void () > on_push )
+	{
+		std::unique_lock	theLock( fMutex );
+		assert( not fHasOnPush.load() );
+		fOnPush = std::move( on_push );
+		fHasOnPush.store( true, std::memory_order_release );
+	}
+
+	// The instrumentation (see the pipe_stats module) - it is off unless set_stats is called.
+	// The stats are passed on to the out queues of the stages joined to this queue,
+	// so it is enough to set them for the first queue of the pipe.
+	void set_stats( std::shared_ptr< TPipeStats > stats ) { fStats = std::move( stats ); }
+
+	const std::shared_ptr< TPipeStats > & stats() const { return fStats; }
+
+	// From now on, the depth of the queue is recorded at each push - set by the stage that pops from it
+	void set_depth_stats( TQueueStats * depth_stats )
+	{
+		std::unique_lock	theLock( fMutex );
+		fDepthStats = depth_stats;
+	}
+
+private:
+
+	// Must be called under the lock
+	void RecordDepth()
+	{
+		if( fDepthStats )		// this is all the cost if the stats are off
+			fDepthStats->Record( fQueue.size() );
+	}
+
+	// Must be called under the lock
+	EQueueErr StopReason() const { return fCancelled ? EQueueErr::kCancelled : EQueueErr::kClosed; }
+
+	void CallOnPush()
+	{
+		if( fHasOnPush.load( std::memory_order_acquire ) )	// once set, fOnPush never changes
+			fOnPush();
+	}
+
+public:
+
+	explicit TSynchroQueue( std::size_t capacity = kUnbounded ) : kCapacity( capacity )
+	{
+		assert( kCapacity > 0 );
+	}
+
+	// This blocks also creation of the copy and move constructors, as well as the copy assignment.
+	// However, the destructor is created by the compiler.
+	// See the book by N. Jousuttis.
+	TSynchroQueue & operator = ( TSynchroQueue && ) = delete;
+
+private:
+
+	const std::size_t				kCapacity;
+
+	std::pmr::unsynchronized_pool_resource		fNodePool;		// fQueue is used only under fMutex, so no need to synchronize the pool
+
+	std::queue< Elem, std::pmr::deque< Elem > >	fQueue { std::pmr::deque< Elem >( & fNodePool ) };
+
+	mutable std::mutex			fMutex;
+
+	std::condition_variable		fCondVar;				// signals that the queue is not empty
+
+	std::condition_variable		fNotFullCondVar;		// signals that the queue is not full
+
+	std::size_t						fPopSeqNo {};			// the next number given by pop_sequenced
+
+	bool								fClosed {};
+
+	bool								fCancelled {};			// implies fClosed
+
+	std::function< void () >	fOnPush;
+
+	std::atomic< bool >			fHasOnPush {};
+
+	std::shared_ptr< TPipeStats >	fStats;
+
+	TQueueStats *					fDepthStats {};
+
+
+
+};
+
+
+
+
+
+// -----------------------------------------------------------
+// The bounded, lock-free single-producer / single-consumer (SPSC) ring queue.
+// It has the same push/pop/size surface as TSynchroQueue, so it can replace it
+// whenever exactly one thread pushes and exactly one thread pops - this is the case
+// of each queue between the stages of the parallel pipe.
+// There is no mutex and no per-element allocation - the elements live in a ring
+// allocated once in the constructor. The producer and the consumer indices are placed
+// in separate cache lines to avoid false sharing.
+// If the ring is full, then push waits; if it is empty, then pop waits.
+// close() and cancel() set the flags kept in the top bits of the indices.
+// kCapacity must be a power of 2.
+
+
+export template < typename Elem, std::size_t kCapacity = 1024 >
+requires ( kCapacity > 1 && ( kCapacity & ( kCapacity - 1 ) ) == 0 )
+class TSpscRingQueue
+{
+
+public:
+
+	using value_type = Elem;
+
+	using ExpectedElem = std::expected< Elem, EQueueErr >;
+
+	// Fixed, as the 64-byte alignment of TDenseMatrix - std::hardware_destructive_interference_size
+	// may differ between the translation units (and GCC warns about it in a module interface)
+	static constexpr std::size_t	kCacheLineSize { 64 };
+
+public:
+
+	// Called ONLY by the producer thread
+	void push( Elem && in_elem )
+	{
+		const auto tail = fTail.load( std::memory_order_relaxed );	// the index is written only by this thread
+		if( tail & kFlagBits )
+		{
+			assert( tail & kCancelledFlag );		// as in TSynchroQueue - the element is dropped
+			return;
+		}
+
+		// The cached value of fHead is always behind the real one, so only if the ring looks full
+		// we need to go to the cache line of the consumer
+		while( tail - fHeadCache == kCapacity )
+		{
+			AwaitChange( fHead, tail - kCapacity );
+			if( not UpdateHeadCache() )
+				return;
+		}
+
+		Store( fRing[ tail & kIndexMask ], std::move( in_elem ) );
+
+		fTail.fetch_add( 1, std::memory_order_release );		// publish the element to the consumer (with no change to the flags)
+		fTail.notify_one();
+	}
+
+	// Called ONLY by the producer thread.
+	// Does not block - returns false if the ring is full or closed (in_elem is left untouched then).
+	bool try_push( Elem && in_elem )
+	{
+		const auto tail = fTail.load( std::memory_order_relaxed );
+
+		if( tail & kFlagBits )
+			return false;
+
+		if( tail - fHeadCache == kCapacity && ( not UpdateHeadCache() || tail - fHeadCache == kCapacity ) )
+			return false;
+
+		Store( fRing[ tail & kIndexMask ], std::move( in_elem ) );
+
+		fTail.fetch_add( 1, std::memory_order_release );
+		fTail.notify_one();
+		return true;
+	}
+
+	// Called ONLY by the producer thread.
+	// Waits while the ring is full but no longer than timeout. Returns false if the time is out.
+	// There is no timed wait on std::atomic, so here we poll, yielding the processor in between.
+	template < typename Rep, typename Period >
+	bool push_for( Elem && in_elem, const std::chrono::duration< Rep, Period > & timeout )
+	{
+		const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+		while( not try_push( std::move( in_elem ) ) )
+		{
+			if( std::chrono::steady_clock::now() >= deadline || ( fTail.load( std::memory_order_relaxed ) & kFlagBits ) )
+				return false;
+
+			std::this_thread::yield();
+		}
+
+		return true;
+	}
+
+	// Called ONLY by the consumer thread
+	ExpectedElem pop( void )
+	{
+		const auto head = fHead.load( std::memory_order_relaxed );	// the index is written only by this thread
+		if( head & kCancelledFlag )
+			return std::unexpected( EQueueErr::kCancelled );
+
+		while( head == fTailCache )
+		{
+			AwaitChange( fTail, head );
+			if( auto err = UpdateTailCache( head ); err )
+				return std::unexpected( * err );
+		}
+
+		ExpectedElem out_elem( std::move( fRing[ head & kIndexMask ] ) );
+
+		fHead.fetch_add( 1, std::memory_order_release );		// give the slot back to the producer
+		fHead.notify_one();
+
+		return out_elem;
+	}
+
+	// The batched versions - the index is published and the other side is notified
+	// once per a chunk of elements, rather than once per each element.
+
+	// Called ONLY by the producer thread
+	void push_bulk( std::span< Elem > in_elems )
+	{
+		for( auto tail = fTail.load( std::memory_order_relaxed ); not in_elems.empty(); )
+		{
+			if( tail & kFlagBits )
+			{
+				assert( tail & kCancelledFlag );
+				return;
+			}
+
+			while( tail - fHeadCache == kCapacity )
+			{
+				AwaitChange( fHead, tail - kCapacity );
+				if( not UpdateHeadCache() )
+					return;
+			}
+
+			// Take as many as there are free slots
+			const auto n = std::min( kCapacity - ( tail - fHeadCache ), in_elems.size() );
+			for( std::size_t i {}; i < n; ++ i )
+				Store( fRing[ ( tail + i ) & kIndexMask ], std::move( in_elems[ i ] ) );
+
+			tail = fTail.fetch_add( n, std::memory_order_release ) + n;		// the flags come with it - cancel() could have been called
+			fTail.notify_one();
+
+			in_elems = in_elems.subspan( n );
+		}
+	}
+
+	// Called ONLY by the consumer thread.
+	// Blocks until the queue is not empty, then moves up to max_n elements to the end of out_elems.
+	// Returns the number of the elements taken - 0 only if the queue is closed and drained, or cancelled.
+	std::size_t pop_bulk( std::vector< Elem > & out_elems, std::size_t max_n )
+	{
+		assert( max_n > 0 );
+
+		const auto head = fHead.load( std::memory_order_relaxed );
+		if( head & kCancelledFlag )
+			return 0;
+
+		while( head == fTailCache )
+		{
+			AwaitChange( fTail, head );
+			if( UpdateTailCache( head ) )
+				return 0;
+		}
+
+		const auto n = std::min( fTailCache - head, max_n );
+		for( std::size_t i {}; i < n; ++ i )
+			out_elems.push_back( std::move( fRing[ ( head + i ) & kIndexMask ] ) );
+
+		fHead.fetch_add( n, std::memory_order_release );
+		fHead.notify_one();
+
+		return n;
+	}
+
+	// Can be called from any thread but the returned value is only a snapshot
+	auto size() const
+	{
+		const auto head = fHead.load( std::memory_order_acquire ) & kIndexMaskOfAll;	// read head first - then tail >= head
+		return ( fTail.load( std::memory_order_acquire ) & kIndexMaskOfAll ) - head;
+	}
+
+	static constexpr auto capacity() { return kCapacity; }		// the SPSC ring is always bounded
+
+	// Called ONLY by the producer thread - the end of the data.
+	// The consumer gets what is left in the ring, then EQueueErr::kClosed.
+	void close()
+	{
+		fTail.fetch_or( kClosedFlag, std::memory_order_release );
+		fTail.notify_one();
+	}
+
+	// Can be called from any thread - both sides are woken up, the consumer gets EQueueErr::kCancelled
+	// (the elements left in the ring are not given out), and the producer's pushes are ignored.
+	void cancel()
+	{
+		fTail.fetch_or( kCancelledFlag, std::memory_order_release );
+		fHead.fetch_or( kCancelledFlag, std::memory_order_release );
+		fTail.notify_one();
+		fHead.notify_one();
+	}
+
+	bool is_closed() const { return fTail.load( std::memory_order_acquire ) & kFlagBits; }
+
+	bool is_cancelled() const { return fTail.load( std::memory_order_acquire ) & kCancelledFlag; }
+
+public:
+
+	TSpscRingQueue() : fRing( kCapacity ) {}
+
+	// The same as in TSynchroQueue - no copy and no move
+	TSpscRingQueue & operator = ( TSpscRingQueue && ) = delete;
+
+private:
+
+	static constexpr std::size_t	kIndexMask { kCapacity - 1 };
+
+	// The two top bits of fTail and fHead are the flags - so the state changes always wake up
+	// the thread waiting on the index, and no other synchronization is needed.
+	// The indices never reach these bits (it would take 2^62 elements).
+	static constexpr std::size_t	kCancelledFlag		{ std::size_t { 1 } << ( std::numeric_limits< std::size_t >::digits - 1 ) };
+	static constexpr std::size_t	kClosedFlag			{ kCancelledFlag >> 1 };
+	static constexpr std::size_t	kFlagBits			{ kCancelledFlag | kClosedFlag };
+	static constexpr std::size_t	kIndexMaskOfAll	{ ~ kFlagBits };
+
+	static constexpr int				kSpinCount { 256 };
+
+	// Spin for a while (the other side is usually just about to do its job),
+	// then go to sleep until the index changes from old_val
+	static void AwaitChange( const std::atomic< std::size_t > & index, std::size_t old_val )
+	{
+		for( int i {}; i < kSpinCount; ++ i )
+		{
+			if( index.load( std::memory_order_acquire ) != old_val )
+				return;
+			CpuRelax();
+		}
+
+		index.wait( old_val, std::memory_order_acquire );
+	}
+
+	// One turn of the spin - tells the core to slow down, so the sibling hyperthread is not starved
+	static void CpuRelax()
+	{
+	#if defined( SIMD_X86 )
+		_mm_pause();
+	#else
+		std::this_thread::yield();
+	#endif
+	}
+
+	// The producer side - returns false if the queue is cancelled
+	bool UpdateHeadCache()
+	{
+		const auto head = fHead.load( std::memory_order_acquire );
+		fHeadCache = head & kIndexMaskOfAll;
+		return not ( head & kCancelledFlag );
+	}
+
+	// The consumer side - returns the error if there is nothing more to take
+	std::optional< EQueueErr > UpdateTailCache( std::size_t head )
+	{
+		const auto tail = fTail.load( std::memory_order_acquire );
+		fTailCache = tail & kIndexMaskOfAll;
+
+		if( tail & kCancelledFlag )
+			return EQueueErr::kCancelled;
+		if( ( tail & kClosedFlag ) && fTailCache == head )
+			return EQueueErr::kClosed;		// closed and drained
+		return std::nullopt;
+	}
+
+	// The element is constructed in the slot, not assigned to it - assigning e.g. std::pmr::string
+	// from the one in other memory would copy its buffer into the memory of the slot
+	static void Store( Elem & slot, Elem && in_elem )
+	{
+		if constexpr( std::is_nothrow_move_constructible_v< Elem > )
+		{
+			std::destroy_at( & slot );
+			std::construct_at( & slot, std::move( in_elem ) );
+		}
+		else
+		{
+			slot = std::move( in_elem );
+		}
+	}
+
+private:
+
+	// The consumer's cache line - the index of the next element to pop and the last seen fTail
+	alignas( kCacheLineSize ) std::atomic< std::size_t >		fHead {};
+	std::size_t																fTailCache {};
+
+	// The producer's cache line - the index of the next free slot and the last seen fHead
+	alignas( kCacheLineSize ) std::atomic< std::size_t >		fTail {};
+	std::size_t																fHeadCache {};
+
+	// The ring itself - only its buffer is shared, the vector object is never modified
+	alignas( kCacheLineSize ) std::vector< Elem >				fRing;
+
+};
+
+
+
+
+
+// -----------------------------------------------------------
+// The reorder buffer - the elements come in any order, each with its sequence number
+// (as given by TSynchroQueue::pop_sequenced), and they are passed to the out queue
+// strictly in the order of their numbers.
+// The memory is bounded - at most kWindow elements are held. A thread which brings
+// an element too far ahead of the oldest missing one waits until the window moves on.
+// Thus kWindow must be at least the number of the threads pushing to the buffer.
+
+
+export template < typename Elem >
+class TReorderBuffer
+{
+
+public:
+
+	using value_type = Elem;
+
+public:
+
+	explicit TReorderBuffer( std::size_t window ) : kWindow( window ), fSlots( window )
+	{
+		assert( kWindow > 0 );
+	}
+
+	TReorderBuffer & operator = ( TReorderBuffer && ) = delete;
+
+public:
+
+	// Stores in_elem numbered seq_no. Then, all elements that are next in order
+	// are moved to out_q with one push_bulk.
+	template < typename OutQueue >
+	void push( std::size_t seq_no, Elem && in_elem, OutQueue & out_q )
+	{
+		std::unique_lock	theLock( fMutex );
+
+		fCondVar.wait( theLock, [ this, seq_no ]() { return seq_no < fNextSeqNo + kWindow || fCancelled; } );
+
+		if( fCancelled )
+			return;		// the missing ones will never come
+
+		assert( seq_no >= fNextSeqNo );
+		auto & slot = fSlots[ seq_no % kWindow ];
+		assert( not slot );
+		slot.emplace( std::move( in_elem ) );
+
+		if( seq_no != fNextSeqNo )
+			return;		// the older ones are still missing - someone else will pass this one further on
+
+		// Collect all consecutive elements starting from the oldest one
+		fReady.clear();
+		for( auto * next = & fSlots[ fNextSeqNo % kWindow ]; next->has_value(); next = & fSlots[ fNextSeqNo % kWindow ] )
+		{
+			fReady.push_back( std::move( * * next ) );
+			next->reset();
+			++ fNextSeqNo;
+		}
+
+		out_q.push_bulk( fReady );		// still under the lock - otherwise two threads could interleave their chunks
+
+		theLock.unlock();
+		fCondVar.notify_all();			// the window has moved on
+	}
+
+	// Wakes up the waiting threads - then push drops the elements
+	void cancel()
+	{
+		{
+			std::unique_lock	theLock( fMutex );
+			fCancelled = true;
+		}
+
+		fCondVar.notify_all();
+	}
+
+private:
+
+	const std::size_t							kWindow;
+
+	std::vector< std::optional< Elem > >	fSlots;		// a ring of kWindow slots indexed with seq_no % kWindow
+
+	std::vector< Elem >						fReady;		// the in-order elements to be moved to the out queue
+
+	std::size_t									fNextSeqNo {};
+
+	bool											fCancelled {};
+
+	std::mutex									fMutex;
+
+	std::condition_variable					fCondVar;
+
+};
+
+
+
+
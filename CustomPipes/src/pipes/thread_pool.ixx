@@ -0,0 +1,191 @@
+// ---------------------------------------------------
+// Created by Boguslaw Cyganek (C) 2024
+// ---------------------------------------------------
+
+
+export module thread_pool;
+
+
+
+
+import <cstddef>;
+import <cassert>;
+import <algorithm>;
+import <functional>;
+import <vector>;
+import <deque>;
+import <memory>;
+import <mutex>;
+import <condition_variable>;
+import <atomic>;
+import <thread>;
+import <stop_token>;
+
+
+
+// -----------------------------------------------------------
+// The work-stealing thread pool.
+// There is a fixed number of threads (by default one per core), each with its own deque of tasks.
+// A task submitted from a worker goes to the back of its own deque and is taken from there
+// (LIFO - the data is likely still in the cache). A worker with an empty deque steals
+// from the front of the others. The tasks submitted from the outside are spread round-robin.
+// The idle workers sleep on the condition variable.
+
+
+export class TWorkStealingPool
+{
+
+public:
+
+	using Task = std::move_only_function< void () >;
+
+public:
+
+	explicit TWorkStealingPool( std::size_t num_of_threads = std::max( 1u, std::thread::hardware_concurrency() ) )
+	{
+		assert( num_of_threads > 0 );
+
+		for( std::size_t i {}; i < num_of_threads; ++ i )
+			fWorkers.push_back( std::make_unique< Worker >() );
+
+		for( std::size_t i {}; i < num_of_threads; ++ i )
+			fThreads.emplace_back( [ this, i ]( std::stop_token st ) { WorkerLoop( st, i ); } );
+	}
+
+	// The workers are stopped and joined - but first they run all tasks submitted so far (also the ones
+	// these submit). A dropped task could be the resumption of a coroutine (e.g. from TAsyncQueue::push
+	// or close()) - its frame would never be destroyed. The coroutines waiting on a queue which is still
+	// open are not tasks yet, so all async queues must be closed (or cancelled) before the pool goes away.
+	~TWorkStealingPool()
+	{
+		for( auto & t : fThreads )
+			t.request_stop();
+
+		{
+			std::unique_lock	theLock( fSleepMutex );		// make sure no one is between checking the predicate and going to sleep
+		}
+		fSleepCondVar.notify_all();
+
+		fThreads.clear();		// jthreads join here
+		assert( fPendingTasks == 0 );
+	}
+
+	TWorkStealingPool & operator = ( TWorkStealingPool && ) = delete;
+
+public:
+
+	void submit( Task && task )
+	{
+		// Count it first - this way fPendingTasks never drops below zero when the task is taken
+		{
+			std::unique_lock	theLock( fSleepMutex );
+			++ fPendingTasks;
+		}
+
+		// If called from our worker, then put the task to its own deque, otherwise to the next one
+		const auto idx = tl_Pool == this ? tl_WorkerIdx : fNextWorker.fetch_add( 1, std::memory_order_relaxed ) % fWorkers.size();
+
+		{
+			auto & w = * fWorkers[ idx ];
+			std::unique_lock	theLock( w.fMutex );
+			w.fTasks.push_back( std::move( task ) );
+		}
+
+		fSleepCondVar.notify_one();
+	}
+
+	auto size() const { return fThreads.size(); }
+
+private:
+
+	struct Worker
+	{
+		std::mutex				fMutex;
+		std::deque< Task >	fTasks;
+	};
+
+	bool TryTakeTask( std::size_t my_idx, Task & out_task )
+	{
+		// First from the back of our own deque
+		{
+			auto & w = * fWorkers[ my_idx ];
+			std::unique_lock	theLock( w.fMutex );
+			if( not w.fTasks.empty() )
+			{
+				out_task = std::move( w.fTasks.back() );
+				w.fTasks.pop_back();
+				return true;
+			}
+		}
+
+		// Then try to steal from the front of the others
+		for( std::size_t i { 1 }; i < fWorkers.size(); ++ i )
+		{
+			auto & w = * fWorkers[ ( my_idx + i ) % fWorkers.size() ];
+			std::unique_lock	theLock( w.fMutex, std::try_to_lock );		// do not wait on a busy one - go to the next
+			if( theLock.owns_lock() && not w.fTasks.empty() )
+			{
+				out_task = std::move( w.fTasks.front() );
+				w.fTasks.pop_front();
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void WorkerLoop( std::stop_token st, std::size_t my_idx )
+	{
+		tl_Pool			= this;
+		tl_WorkerIdx	= my_idx;
+
+		Task	task;
+
+		for( ;; )
+		{
+			if( TryTakeTask( my_idx, task ) )
+			{
+				fPendingTasks.fetch_sub( 1, std::memory_order_relaxed );
+				task();
+				task = nullptr;		// release whatever the task holds
+				continue;
+			}
+
+			// Stop only when no task is left - a task being run by another worker can submit a new one,
+			// but then that worker is still here to take it
+			if( st.stop_requested() && fPendingTasks.load( std::memory_order_relaxed ) == 0 )
+				break;
+
+			// Nothing to do - go to sleep until a task is submitted.
+			// Since fPendingTasks counts also the tasks which can be stolen only with try_to_lock,
+			// a worker can be woken up more often than necessary, but never misses a task.
+			std::unique_lock	theLock( fSleepMutex );
+			fSleepCondVar.wait( theLock, st, [ this ]() { return fPendingTasks.load( std::memory_order_relaxed ) > 0; } );
+		}
+
+		tl_Pool = nullptr;
+	}
+
+private:
+
+	std::vector< std::unique_ptr< Worker > >	fWorkers;
+
+	std::atomic< std::size_t >					fNextWorker {};
+
+	std::atomic< std::size_t >					fPendingTasks {};		// submitted but not taken yet
+
+	std::mutex										fSleepMutex;
+
+	std::condition_variable_any				fSleepCondVar;
+
+	std::vector< std::jthread >				fThreads;				// the last member - the threads start when all the rest is ready
+
+	// Lets a worker recognize its own pool
+	static inline thread_local TWorkStealingPool *	tl_Pool {};
+	static inline thread_local std::size_t				tl_WorkerIdx {};
+
+};
+
+
+
+
@@ -0,0 +1,228 @@
+// ---------------------------------------------------
+// Created by Boguslaw Cyganek (C) 2024
+// ---------------------------------------------------
+
+
+export module vectors_pipe;
+
+
+
+
+import <cstddef>;
+import <cassert>;
+import <cmath>;
+import <vector>;
+import <string>;
+import <expected>;
+import <numeric>;
+import <algorithm>;
+import <filesystem>;
+import <iterator>;
+import <sstream>;
+import <fstream>;
+import <tuple>;
+import <limits>;
+import <span>;
+import <concepts>;
+
+import dense_matrix;
+import similarity;
+
+
+
+// -----------------------------------------------------------
+// The stages of the pipe of the vectors: a directory -> the paths of its files -> the vectors
+// read from them -> the normalized vectors -> their similarities -> the most similar pair.
+// Each stage takes and returns a different std::expected, so they can be joined with the
+// operator | of the serial pipe (see custom_pipe_serial.cpp), as well as by the typed
+// parallel pipe (see custom_pipe_parallel.cpp), where each of them runs in its own thread.
+
+
+
+namespace fs = std::filesystem;
+
+
+
+export namespace VectorsPipeTest
+{
+
+
+	using ::ENormErr;				// see the dense_matrix module
+	using ::normalize_row;
+
+
+	using DType = double;		
+	using DVec = std::vector< DType >;		
+
+	using Matrix = TDenseMatrix< DType >;		// one vector per row, all in one block of memory
+
+	using PathVec = std::vector< std::filesystem::path >;
+
+
+	enum class LoadErr { kNoData, kWrongPath, kCannotOpen, kWrongData };
+	using load_exp = std::expected< PathVec, LoadErr >;
+
+
+
+	using vec_vec_exp = std::expected< Matrix, ENormErr >;
+
+	enum class DistErr { kZeroLen, kWrongData };
+	using dist_exp = std::expected< Matrix, DistErr >;
+
+
+	enum class PathErr { kEmpty };		// no path provided
+	using path_exp = std::expected< std::filesystem::path, PathErr >;
+
+	// traverse and collect all paths in this directory of files with the "accept_ext" extension
+	inline load_exp load_paths( path_exp && pe, const std::filesystem::path & accept_ext )
+	{
+		if( ! pe )	// if no objects to process, then exit passing an error
+			return std::unexpected( LoadErr::kWrongData );
+
+		if( ! fs::exists( * pe ) || ! fs::is_directory( * pe ) )
+			return std::unexpected( LoadErr::kWrongPath );		// exit if wrong path (not existing or not a dir)
+
+		// Iterate through the directory
+		load_exp retExp {};
+		for( const auto & file_obj : fs::directory_iterator( * pe ) )
+				if( fs::is_regular_file( file_obj ) )	
+					if( file_obj.path().extension().string().contains( accept_ext.string() ) )
+						retExp->push_back( file_obj.path() );
+
+		return retExp->size() > 0 ? retExp : std::unexpected { LoadErr::kNoData };
+	}
+
+
+
+
+
+	// open all files and read the vectors 
+	inline vec_vec_exp load_vectors( load_exp && le )
+	{
+		if( ! le )	// if no objects to process, then exit passing an error
+			return std::unexpected( ENormErr::kEmptyVec );
+
+		// open each file and read vectors - each becomes a row of the matrix
+		Matrix	retVecs;
+		DVec		theVec;		// the vector of one line - reused, so there is no allocation per line
+		for( const auto & f : * le )
+		{
+			if( std::ifstream inFile( f ); inFile.is_open() )
+			{
+				for( std::string str; std::getline( inFile, str ) && str.length() > 0; )	// read the entire line into the string
+				{
+					std::istringstream istr( str );
+					using DType_Iter = std::istream_iterator< DType >;
+
+					theVec.assign( DType_Iter{ istr }, DType_Iter{} );
+
+					if( theVec.empty() )
+						return std::unexpected( ENormErr::kEmptyVec );
+					if( ! retVecs.push_row( theVec ) )
+						return std::unexpected( ENormErr::kWrongVals );		// all vectors must be of the same length
+				}
+			}
+		}
+
+		return ! retVecs.empty() ? vec_vec_exp { std::move( retVecs ) } : std::unexpected( ENormErr::kEmptyVec );
+	}
+
+
+	inline vec_vec_exp vec_normalize( vec_vec_exp && vve )
+	{
+		if( ! vve )	// if no objects to process, then exit with an error
+			return std::unexpected( ENormErr::kEmptyVec );
+
+		for( Matrix::size_type r {}; r < vve->rows(); ++ r )
+			if( auto env = normalize_row( vve->row( r ) ); ! env.has_value() )
+				return std::unexpected( env.error() );		// stop immediately and pass the error out
+
+		return std::move( vve );
+	}
+
+					
+	// Computes a cosine distance between vectors
+	// We assume that the input vectors are already normalized
+	inline dist_exp comp_distance( vec_vec_exp && vve )
+	{
+		if( ! vve )	// if no objects to process, then exit passing an error
+			return std::unexpected( DistErr::kWrongData );
+
+		const auto kColsRows { vve->rows() };	// it's a square matrix
+		if( kColsRows == 0 )
+			return std::unexpected( DistErr::kZeroLen );
+
+		Matrix distances( kColsRows, kColsRows );
+
+		gram_upper( * vve, distances, SimilarityPool() );		// distances( r, c ) = vve->row( r ) . vve->row( c ) for c > r - blocked, with SIMD, by all cores
+
+		return distances;
+	}
+
+
+	using index_val = std::tuple< Matrix::size_type, Matrix::size_type, DType >;
+	using max_exp = std::expected< index_val, DistErr >;
+
+	using nearest_exp = std::expected< TNearest, DistErr >;
+
+	inline max_exp find_max( dist_exp && de )
+	{
+		if( ! de )	// if no objects to process, then exit passing an error
+			return std::unexpected( DistErr::kWrongData );
+
+		const auto kColsRows { de->rows() };	// it's a square matrix
+		assert( kColsRows > 0 );
+		assert( de->cols() == kColsRows );
+
+		constexpr DType kNoneVal { std::numeric_limits< DType >::lowest() };
+
+		// By all cores - the first maximum in the row by row order, whatever the number of threads
+		const auto theMax = argmax_upper( * de, SimilarityPool() );
+		assert( theMax.fVal == kNoneVal || ( theMax.fVal >= -1.1 && theMax.fVal <= +1.1 ) );
+
+		index_val ret { theMax.fRow, theMax.fCol, theMax.fVal };
+
+		return std::get< 2 >( ret ) != kNoneVal ? max_exp { ret } : std::unexpected( DistErr::kWrongData );
+	}
+
+
+	// The fused comp_distance | find_max - the similarities are computed tile by tile and only the maximum
+	// is kept, so there is no N x N matrix (the memory is O( N D ) rather than O( N^2 )). The result is the same.
+	inline max_exp find_max_fused( vec_vec_exp && vve )
+	{
+		if( ! vve )	// if no objects to process, then exit passing an error
+			return std::unexpected( DistErr::kWrongData );
+
+		if( vve->rows() == 0 )
+			return std::unexpected( DistErr::kZeroLen );
+
+		constexpr DType kNoneVal { std::numeric_limits< DType >::lowest() };
+
+		const auto theMax = max_pair( * vve, SimilarityPool() );
+
+		return theMax.fVal != kNoneVal ? max_exp { index_val { theMax.fRow, theMax.fCol, theMax.fVal } } : std::unexpected( DistErr::kWrongData );
+	}
+
+
+	// Makes the stage, which finds the k_pairs most similar pairs and the k_nn nearest neighbours of each vector -
+	// all in one pass over the similarities, with the bounded heaps (see nearest()). The results are sorted, so these
+	// for any smaller k are at their beginnings - there is no need to run the pipe again for each k.
+	inline auto find_nearest( std::size_t k_pairs, std::size_t k_nn )
+	{
+		return [ = ]( vec_vec_exp && vve ) -> nearest_exp
+		{
+			if( ! vve )	// if no objects to process, then exit passing an error
+				return std::unexpected( DistErr::kWrongData );
+
+			if( vve->rows() < 2 )
+				return std::unexpected( vve->rows() == 0 ? DistErr::kZeroLen : DistErr::kWrongData );		// no pairs
+
+			return nearest( * vve, k_pairs, k_nn, SimilarityPool() );
+		};
+	}
+
+
+}
+
+
+